@@ -231,6 +231,27 @@ void db_periodic (void)
 				/* Dump all debugging information */
 				db_dump_all ();
 				break;
+
+#ifdef CONFIG_CALLSET_PROFILE
+			case 'c':
+				/* Dump the event handler profile */
+				callset_profile_dump ();
+				break;
+#endif
+
+#ifdef CONFIG_SWITCH_TRACE
+			case 's':
+				/* Dump the switch latencies */
+				switch_trace_dump ();
+				break;
+#endif
+
+#ifdef CONFIG_LOG
+			case 'l':
+				/* Dump the event log */
+				log_dump ();
+				break;
+#endif
 #endif
 
 #ifdef CONFIG_BPT
@@ -193,20 +193,36 @@ void ll_scores_draw_current (U8 player)
 }
 
 
+/* The status line is redrawn with the scores, so its formats are
+precompiled; see sprintf_plan. */
 #ifdef CONFIG_TIMED_GAME
+static const struct sprintf_op timed_plan[] = {
+	SPF_TEXT ("TIME REMAINING: "),
+	SPF_FIELD (SPF_DECIMAL, 0),
+	SPF_TEXT (":"),
+	SPF_FIELD (SPF_DECIMAL | SPF_ZEROES, 2),
+	SPF_FINISH
+};
+
 void ll_score_draw_timed (U8 min, U8 sec)
 {
-	sprintf ("TIME REMAINING: %d:%02d", min, sec);
+	sprintf_plan (timed_plan, min, sec);
 	font_render_string_center (&font_var5, 64, DMD_STATUS_ROW, sprintf_buffer);
 }
 #endif
 
 
+static const struct sprintf_op ball_plan[] = {
+	SPF_TEXT ("BALL "),
+	SPF_FIELD (SPF_DECIMAL, 1),
+	SPF_FINISH
+};
+
 void ll_score_draw_ball (void)
 {
 	credits_render ();
 	font_render_string_center (&font_var5, 96, DMD_STATUS_ROW, sprintf_buffer);
-	sprintf ("BALL %1i", ball_up);
+	sprintf_plan (ball_plan, ball_up);
 	font_render_string_center (&font_var5, 32, DMD_STATUS_ROW, sprintf_buffer);
 }
 
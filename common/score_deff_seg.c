@@ -40,15 +40,31 @@ void ll_score_change_player (void)
 {
 }
 
+/* The status line is redrawn with the scores, so its formats are
+precompiled; see sprintf_plan. */
+static const struct sprintf_op timed_plan[] = {
+	SPF_TEXT ("TIME "),
+	SPF_FIELD (SPF_DECIMAL, 0),
+	SPF_TEXT (":"),
+	SPF_FIELD (SPF_DECIMAL | SPF_ZEROES, 2),
+	SPF_FINISH
+};
+
+static const struct sprintf_op ball_plan[] = {
+	SPF_TEXT ("BALL "),
+	SPF_FIELD (SPF_DECIMAL, 1),
+	SPF_FINISH
+};
+
 void ll_score_draw_timed (U8 min, U8 sec)
 {
-	sprintf ("TIME %d:%02d", min, sec);
+	sprintf_plan (timed_plan, min, sec);
 	seg_write_string (1, 8, sprintf_buffer);
 }
 
 void ll_score_draw_ball (void)
 {
-	sprintf ("BALL %1i", ball_up);
+	sprintf_plan (ball_plan, ball_up);
 	seg_write_string (1, 10, sprintf_buffer);
 }
 
@@ -209,7 +209,7 @@ void sound_start1 (U8 channels, sound_code_t code)
 			//sound_write (SND_INIT_CH0 + chid);
 
 			/* Write to the sound board and return */
-			sound_write (code);
+			sound_write (code, sound_start_prio);
 			return;
 		}
 	}
@@ -262,7 +262,7 @@ void sound_proc_send (U8 channels, sound_code_t code)
 	//U8 chid = sound_proc_channel_id ();
 	// the process should only be allowed to write to
 	// channels that were previously allocated to it
-	sound_write (code);
+	sound_write (code, SP_NORMAL);
 }
 
 
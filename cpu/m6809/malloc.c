@@ -18,43 +18,69 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#ifndef STANDALONE
 #include <freewpc.h>
+#endif
 
 /* Design:
  * We use the block allocator provided by task.c to provide us with chunks
- * of memory of size 'sizeof (task_t)', which must be at least 41 bytes.
+ * of memory of size 'sizeof (task_t)', which must be at least 55 bytes.
  * 1 byte of this is reserved for task 'state', here it means that the
  * dispatcher should skip those blocks that are being used for dynamic memory.
  *
- * The raw allocator then reserves the first 4 bytes of any such chunk
- * for its own housekeeping.  See malloc_chunk_header_t.  The chunk header
+ * The raw allocator then reserves the first 6 bytes of any such chunk
+ * for its own housekeeping.  See malloc_chunk_t.  The chunk header
  * contains next/prev pointers for maintaining a linked list of chunks.
  *
  * The remaining bytes of the chunk are subdivided into smaller blocks
  * that are actually handed out to callers of malloc().  These are called
- * userblocks.  The number of userblocks per chunk depends on the size.
- * Chunks are dedicated to a certain size userblock once created; this
- * is implied by which freelist they are on:
- * - 1 userblock/chunk @ 32 bytes each
- * - 2 userblocks/chunk @ 16 bytes each
- * - 4 userblocks/chunk @ 8 bytes each
+ * userblocks.  Chunks are dedicated to one size class once created; this
+ * is implied by which freelist they are on.  The size classes are listed
+ * in chunk_sizes[], and the number of userblocks per chunk for each is
+ * however many fit in the chunk, up to 8.  With a 59-byte task block:
+ * - 8 userblocks/chunk @ 4 bytes each
+ * - 5 userblocks/chunk @ 8 bytes each
+ * - 4 userblocks/chunk @ 12 bytes each
+ * - 3 userblocks/chunk @ 16 bytes each
+ * - 2 userblocks/chunk @ 24 bytes each
+ * - 1 userblock/chunk @ 32 or 48 bytes each
  *
  * Each userblock has a 1-byte header that is used during free to
  * figure out which chunk the block is part of.
+ *
+ * Usage of each class is counted in malloc_stats[].  The collector
+ * keeps enough empty chunks around to cover the recent peak usage of
+ * each class, plus whatever prealloc() asked for, and gives the rest
+ * back to the block allocator.
+ *
+ * This file can also be compiled on the build machine, outside of the
+ * rest of the system, by defining STANDALONE; see tools/mallocbench.
  */
 
 #define ONES_MASK(n) ((1UL << (n)) - 1)
 
+#ifndef offsetof
+#define offsetof(type, member) __builtin_offsetof (type, member)
+#endif
+
 //#define MALLOC_TEST
 
 enum chunk_type
 {
-	CHUNK_TYPE_LEN8 = 0,
+	CHUNK_TYPE_LEN4 = 0,
+	CHUNK_TYPE_LEN8,
+	CHUNK_TYPE_LEN12,
 	CHUNK_TYPE_LEN16,
+	CHUNK_TYPE_LEN24,
 	CHUNK_TYPE_LEN32,
+	CHUNK_TYPE_LEN48,
 };
 
-#define NUM_CHUNK_TYPES 3
+#define NUM_CHUNK_TYPES NUM_MALLOC_CLASSES
+
+/** The largest number of userblocks in any chunk, limited by the
+size of the 'available' bitmap */
+#define MAX_CHUNK_BLOCKS 8
 
 
 /** A per-allocation header that precedes the returned buffer pointer,
@@ -64,11 +90,11 @@ typedef struct _user_header
 	/* Not used.  Keep the reserved bits at the top, as GCC
 	puts earlier fields into the high order bits, which is the
 	least efficient place for them. */
-	U8 reserved : 3;
+	U8 reserved : 2;
 
 	/* type says which size chunk this is.  This is written
 	during chunk allocation and remains constant thereafter. */
-	U8 type : 2;
+	U8 type : 3;
 
 	/* blocknum says which block within the chunk this is.
 	This is written during chunk allocation and remains
@@ -76,14 +102,10 @@ typedef struct _user_header
 	U8 blocknum : 3;
 } user_header_t;
 
-#define NUM_8BYTE_BLOCKS 4
-#define NUM_16BYTE_BLOCKS 2
-#define NUM_32BYTE_BLOCKS 1
-
 
 /** A view of the block structure as it is used for dynamic memory.
- * The size of this structure should be the same as that of the
- * task_struct.  A single chunk corresponds to one or more
+ * The size of this structure plus the userblocks that follow it is
+ * that of the task_struct.  A single chunk corresponds to one or more
  * dynamic memory allocations. */
 typedef struct _malloc_chunk
 {
@@ -103,37 +125,43 @@ typedef struct _malloc_chunk
 	are available */
 	U8 available;
 
-	/** A union of the actual data allocations provided to
-	 * the callers of malloc().  Allocations are rounded
-	 * up to the next 8, 16, or 32 byte boundary.
-	 * For each case, there is an element of the union
-	 * that says how those buffers are arranged and tracked. */
-	union {
-		struct {
-			struct userblock8 {
-				user_header_t flags;
-				U8 data[8];
-			} blocks[NUM_8BYTE_BLOCKS];
-		} len8;
-		struct {
-			struct userblock16 {
-				user_header_t flags;
-				U8 data[16];
-			} blocks[NUM_16BYTE_BLOCKS];
-		} len16;
-		struct {
-			struct userblock32 {
-				user_header_t flags;
-				U8 data[32];
-			} blocks[NUM_32BYTE_BLOCKS];
-		} len32;
-	} u;
+	/** The userblocks, which run to the end of the task block.
+	 * Each is a user_header_t followed by the data returned by
+	 * malloc(), rounded up to the size of the chunk's class. */
+	U8 data[0];
 } malloc_chunk_t;
 
 
+/** The number of bytes in each chunk that are divided into userblocks */
+#ifndef CHUNK_DATA_SIZE
+#define CHUNK_DATA_SIZE (sizeof (task_t) - offsetof (malloc_chunk_t, data))
+#endif
+
+/** The number of userblocks of length 'len' that fit in one chunk */
+#define CHUNK_BLOCKS(len) \
+	((CHUNK_DATA_SIZE / ((len) + 1) > MAX_CHUNK_BLOCKS) ? \
+		MAX_CHUNK_BLOCKS : CHUNK_DATA_SIZE / ((len) + 1))
+
+
+/** The userblock size for each chunk type, in increasing order */
+const U8 chunk_sizes[NUM_CHUNK_TYPES] = {
+	4, 8, 12, 16, 24, 32, 48
+};
+
+/** The number of userblocks per chunk for each chunk type */
+static const U8 chunk_counts[NUM_CHUNK_TYPES] = {
+	CHUNK_BLOCKS (4), CHUNK_BLOCKS (8), CHUNK_BLOCKS (12),
+	CHUNK_BLOCKS (16), CHUNK_BLOCKS (24), CHUNK_BLOCKS (32),
+	CHUNK_BLOCKS (48),
+};
+
+
 /** An array of free lists of chunks, indexed by chunk type */
 malloc_chunk_t *chunk_lists[NUM_CHUNK_TYPES];
 
+/** Usage counters for each chunk type */
+struct malloc_class_stats malloc_stats[NUM_CHUNK_TYPES];
+
 
 /** A lookup table for computing 1^N efficiently */
 static const U8 set_bit_mask[8] = { 
@@ -170,19 +198,16 @@ static const U8 first_one_table[16] = {
 
 static inline enum chunk_type get_chunk_type_for_size (U8 size)
 {
+	enum chunk_type type;
+
 	/* Note, we favor smaller allocations by checking
 	the sizes in increasing order. */
-	if (size <= 8)
-		return CHUNK_TYPE_LEN8;
-	else if (size <= 16)
-		return CHUNK_TYPE_LEN16;
-	else if (size <= 32)
-		return CHUNK_TYPE_LEN32;
-	else
-	{
-		dbprintf ("attempt to malloc too much\n");
-		fatal (ERR_MALLOC);
-	}
+	for (type = CHUNK_TYPE_LEN4; type < NUM_CHUNK_TYPES; type++)
+		if (size <= chunk_sizes[type])
+			return type;
+
+	dbprintf ("attempt to malloc too much\n");
+	fatal (ERR_MALLOC);
 }
 
 
@@ -192,6 +217,30 @@ static inline malloc_chunk_t **get_chunks_for_type (enum chunk_type type)
 }
 
 
+/** Return the header of a userblock within a chunk */
+static inline user_header_t *get_userblock (malloc_chunk_t *chunk,
+	enum chunk_type type, U8 blocknum)
+{
+	return (user_header_t *)(chunk->data + blocknum * (chunk_sizes[type] + 1));
+}
+
+
+/** Return the type of a chunk, as recorded in its first userblock */
+static inline enum chunk_type get_chunk_type (malloc_chunk_t *chunk)
+{
+	return ((user_header_t *)chunk->data)->type;
+}
+
+
+/** Return the number of userblocks that are free in all of the chunks
+of a type */
+static U16 malloc_free_blocks (enum chunk_type type)
+{
+	struct malloc_class_stats *stats = &malloc_stats[type];
+	return stats->chunks * chunk_counts[type] - stats->in_use;
+}
+
+
 /** Given a bitmask in 'bits', find the first bit position that is
 nonzero.  It is assumed that 'bits' is nonzero.  This function is
 optimized using a lookup table to scan each nibble fast. */
@@ -209,36 +258,12 @@ U8 find_first_one (U8 bits)
 }
 
 
-#if 0
-/** Dump a userblock's status */
-void userblock_dump (enum chunk_type type, U8 blocknum, user_header_t *flags)
-{
-	if (blocknum != flags->blocknum)
-	{
-		dbprintf ("?B%d/%d", blocknum, flags->blocknum);
-	}
-	else if (type != flags->type)
-	{
-		dbprintf ("?T%d/%d", type, flags->type);
-	}
-	else if (flags->allocated == 0)
-	{
-		dbprintf (".");
-	}
-	else
-	{
-		dbprintf ("X");
-	}
-}
-#endif
-
-
 /* Dump the structure of a task block that is used for malloc(). */
 void malloc_chunk_dump (task_t *task)
 {
 	malloc_chunk_t *chunk = (malloc_chunk_t *)task;
-	enum chunk_type type = chunk->u.len8.blocks[0].flags.type;
-	U8 block, blocks;
+	enum chunk_type type = get_chunk_type (chunk);
+	U8 block;
 
 	dbprintf ("nx=%p  pv=%p  ", chunk->next, chunk->prev);
 
@@ -247,26 +272,9 @@ void malloc_chunk_dump (task_t *task)
 	else
 		dbprintf ("       ");
 
-	switch (type)
-	{
-		case CHUNK_TYPE_LEN8:
-			dbprintf ("MEM(8)  ");
-			blocks = NUM_8BYTE_BLOCKS;
-			break;
-		case CHUNK_TYPE_LEN16:
-			dbprintf ("MEM(16) ");
-			blocks = NUM_16BYTE_BLOCKS;
-			break;
-		case CHUNK_TYPE_LEN32:
-			dbprintf ("MEM(32) ");
-			blocks = NUM_32BYTE_BLOCKS;
-			break;
-		default:
-			blocks = 0;
-			break;
-	}
+	dbprintf ("MEM(%d)  ", chunk_sizes[type]);
 
-	for (block = 0; block < blocks; block++)
+	for (block = 0; block < chunk_counts[type]; block++)
 	{
 		if (chunk->available & (1 << block))
 		{
@@ -282,12 +290,30 @@ void malloc_chunk_dump (task_t *task)
 }
 
 
-/** Allocate and initialize a new chunk of memory.  This is used
-internally. */
+/** Dump the usage counters for each chunk type. */
+void malloc_stats_dump (void)
+{
+#ifdef DEBUGGER
+	enum chunk_type type;
+
+	dbprintf ("SIZE ALLOCS FAIL USE PEAK CHUNKS\n");
+	for (type = 0; type < NUM_CHUNK_TYPES; type++)
+	{
+		struct malloc_class_stats *stats = &malloc_stats[type];
+		dbprintf ("%4d %6ld %4d ", chunk_sizes[type], stats->allocs, stats->fails);
+		dbprintf ("%3ld %4ld %6d\n", stats->in_use, stats->peak, stats->chunks);
+	}
+#endif
+}
+
+
+/** Allocate and initialize a new chunk of memory, and put it at the
+head of the list for its type.  This is used internally.  Returns NULL
+if there are no free blocks. */
 malloc_chunk_t *chunk_allocate (enum chunk_type type)
 {
 	task_t *task = block_allocate ();
-	malloc_chunk_t *chunk;
+	malloc_chunk_t *chunk, *first;
 	U8 block;
 
 	dbprintf ("allocating chunk for type %d\n", type);
@@ -295,142 +321,179 @@ malloc_chunk_t *chunk_allocate (enum chunk_type type)
 	if (!task)
 	{
 		dbprintf ("block_allocate failed\n");
-		fatal (ERR_MALLOC);
+		return NULL;
 	}
 
 	task->state |= BLOCK_MALLOC;
 	chunk = (malloc_chunk_t *)task;
 
 	/* Initialize each of the user blocks in the chunk */
-	switch (type)
+	chunk->available = ONES_MASK(chunk_counts[type]);
+	for (block = 0; block < chunk_counts[type]; block++)
 	{
-		case CHUNK_TYPE_LEN8:
-			chunk->available = ONES_MASK(NUM_8BYTE_BLOCKS);
-			for (block = 0; block < NUM_8BYTE_BLOCKS; block++)
-			{
-				struct userblock8 *ub = &chunk->u.len8.blocks[block];
-				ub->flags.reserved = 0;
-				ub->flags.type = CHUNK_TYPE_LEN8;
-				ub->flags.blocknum = block;
-			}
-			break;
-		case CHUNK_TYPE_LEN16:
-			chunk->available = ONES_MASK(NUM_16BYTE_BLOCKS);
-			for (block = 0; block < NUM_16BYTE_BLOCKS; block++)
-			{
-				struct userblock16 *ub = &chunk->u.len16.blocks[block];
-				ub->flags.reserved = 0;
-				ub->flags.type = CHUNK_TYPE_LEN16;
-				ub->flags.blocknum = block;
-			}
-			break;
-		case CHUNK_TYPE_LEN32:
-			chunk->available = ONES_MASK(NUM_32BYTE_BLOCKS);
-			for (block = 0; block < NUM_32BYTE_BLOCKS; block++)
-			{
-				struct userblock32 *ub = &chunk->u.len32.blocks[block];
-				ub->flags.reserved = 0;
-				ub->flags.type = CHUNK_TYPE_LEN32;
-				ub->flags.blocknum = block;
-			}
-			break;
-
-		default:
-			dbprintf ("invalid type %d in chunk alloc\n", type);
-			fatal (ERR_MALLOC);
+		user_header_t *ub = get_userblock (chunk, type, block);
+		ub->reserved = 0;
+		ub->type = type;
+		ub->blocknum = block;
 	}
 
-	return chunk;
-}
-
-
-/** Allocate a block of dynamic memory. */
-void *malloc (U8 size)
-{
-	malloc_chunk_t *chunk, *first, **chunkptr;
-	U8 blocknum;
-	enum chunk_type type;
-	void *ptr;
-
-	/* Find the first free chunk that can satisfy a request of
-	this size. */
-	type = get_chunk_type_for_size (size);
-	chunkptr = get_chunks_for_type (type);
-
-	if (*chunkptr)
+	/* Make it the head of its list.  The lists are doubly-linked
+	and cyclic. */
+	first = chunk_lists[type];
+	if (first)
 	{
-		chunk = *chunkptr;
+		chunk->next = first;
+		chunk->prev = first->prev;
+		first->prev->next = chunk;
+		first->prev = chunk;
 	}
 	else
 	{
-		/* No chunks of this size are free now.  We need to create
-		a new chunk.  Make it the head of its free list. */
-		chunk = *chunkptr = chunk_allocate (type);
 		chunk->next = chunk->prev = chunk;
 	}
+	chunk_lists[type] = chunk;
+	malloc_stats[type].chunks++;
+	return chunk;
+}
+
+
+/** Take a free userblock from the chunks that already exist for a
+type.  Returns NULL if they are all in use. */
+static void *chunk_list_allocate (enum chunk_type type)
+{
+	malloc_chunk_t *chunk, *first;
+	U8 blocknum;
 
-find_free:
-	/* OK, we have at least 1 chunk on the free list, and 'chunk'
-	points to its head.  Find the first free userblock within the
-	chunk.  If the entire block is used up, then move to the next
-	block on the same list.  Note that the lists are doubly-linked,
-	and cyclic, so end-of-list is detected as the pointer wrapping
-	back to the front. */
-	first = chunk;
+	/* Find the first free userblock within the chunk.  If the entire
+	block is used up, then move to the next block on the same list.
+	End-of-list is detected as the pointer wrapping back to the
+	front. */
+	first = chunk = *get_chunks_for_type (type);
+	if (!chunk)
+		return NULL;
 	do {
 		if (chunk->available)
 		{
 			/* There's at least 1 free block here... take the first one */
 			blocknum = find_first_one (chunk->available);
 			chunk->available &= clear_bit_mask[blocknum];
+			return get_userblock (chunk, type, blocknum) + 1;
+		}
+		chunk = chunk->next;
+	} while (chunk != first);
+	return NULL;
+}
+
+
+/** Give the empty chunks of one type back to the block allocator.
+Unless 'force' is set, enough chunks are kept to cover the most that
+have been used since the last collection, or the amount requested by
+prealloc(). */
+static void malloc_collect_type (enum chunk_type type, bool force)
+{
+	struct malloc_class_stats *stats = &malloc_stats[type];
+	malloc_chunk_t *chunk, *first;
+	U16 keep;
+
+	keep = force ? 0 : (stats->recent > stats->reserve ? stats->recent : stats->reserve);
+
+restart:
+	first = chunk = chunk_lists[type];
+	if (first)
+	{
+		do {
+			if (stats->chunks * chunk_counts[type] - chunk_counts[type] < keep)
+				break;
 
-			switch (type)
+			if (chunk->state == BLOCK_MALLOC+BLOCK_USED
+				&& chunk->available == ONES_MASK(chunk_counts[type]))
 			{
-				case CHUNK_TYPE_LEN8:
-				{
-					struct userblock8 *ub = &chunk->u.len8.blocks[blocknum];
-					ptr = ub->data;
-					break;
-				}
-				case CHUNK_TYPE_LEN16:
-				{
-					struct userblock16 *ub = &chunk->u.len16.blocks[blocknum];
-					ptr = ub->data;
-					break;
-				}
-				case CHUNK_TYPE_LEN32:
+				dbprintf ("freeing chunk %p\n", chunk);
+				chunk->prev->next = chunk->next;
+				chunk->next->prev = chunk->prev;
+				if (chunk == first)
 				{
-					struct userblock32 *ub = &chunk->u.len32.blocks[blocknum];
-					ptr = ub->data;
-					break;
+					if (chunk == chunk->next)
+						chunk_lists[type] = NULL;
+					else
+						chunk_lists[type] = chunk->next;
 				}
-				default:
-					dbprintf ("invalid type %d in find_free\n", type);
-					fatal (ERR_MALLOC);
+				block_free ((task_t *)chunk);
+				stats->chunks--;
+				goto restart;
 			}
-			return ptr;
-		}
-		else
-		{
 			chunk = chunk->next;
-		}
-	} while (chunk != first);
+		} while (chunk != first);
+	}
+
+	/* Start measuring again for the next collection */
+	if (!force)
+		stats->recent = stats->in_use;
+}
+
+
+/** Give all empty chunks back to the block allocator.  This is done
+when the task table is full, before anything more drastic. */
+void malloc_collect_all (void)
+{
+	enum chunk_type type;
+
+	for (type = 0; type < NUM_CHUNK_TYPES; type++)
+		malloc_collect_type (type, TRUE);
+}
 
-	/* There are no free blocks on any of the already allocated
-	chunks.  Need to allocate a new chunk then, and add it to
-	the head of the list. */
-	chunk = *chunkptr = chunk_allocate (type);
-	if (chunk == NULL)
+
+/** Allocate a block of dynamic memory. */
+void *malloc (U8 size)
+{
+	enum chunk_type type, t;
+	struct malloc_class_stats *stats;
+	void *ptr;
+
+	/* Find the first free chunk that can satisfy a request of
+	this size. */
+	type = get_chunk_type_for_size (size);
+	ptr = chunk_list_allocate (type);
+	if (!ptr)
 	{
-		/* OK, we couldn't even allocate a block -- this is serious! */
-		fatal (ERR_NO_FREE_TASKS);
+		/* There are no free blocks on any of the already allocated
+		chunks.  Need to allocate a new chunk then.  If the task
+		table is full, give back empty chunks of other types first. */
+		if (!chunk_allocate (type))
+		{
+			malloc_collect_all ();
+			if (!chunk_allocate (type))
+			{
+				/* Still nothing; settle for a block of a larger type,
+				if one is free. */
+				stats = &malloc_stats[type];
+				if (stats->fails < 0xFF)
+					stats->fails++;
+				for (t = type + 1; t < NUM_CHUNK_TYPES; t++)
+					if ((ptr = chunk_list_allocate (t)) != NULL)
+					{
+						type = t;
+						goto found;
+					}
+
+				/* OK, we couldn't even allocate a block -- this is serious! */
+				fatal (ERR_NO_FREE_TASKS);
+			}
+		}
+		ptr = chunk_list_allocate (type);
 	}
 
-	chunk->next = first;
-	chunk->prev = first->prev;
-	first->prev->next = chunk;
-	first->prev = chunk;
-	goto find_free;
+found:
+	stats = &malloc_stats[type];
+	stats->allocs++;
+	stats->in_use++;
+	if (stats->in_use > stats->recent)
+	{
+		stats->recent = stats->in_use;
+		if (stats->in_use > stats->peak)
+			stats->peak = stats->in_use;
+	}
+	return ptr;
 }
 
 
@@ -443,31 +506,17 @@ void free (void *ptr)
 	malloc_chunk_t *chunk;
 
 	/* Get the chunk type and block number */
-	flags = (user_header_t *)(ptr - 1);
+	flags = (user_header_t *)ptr - 1;
 	type = flags->type;
 	blocknum = flags->blocknum;
 
-	/* Get a pointer to the first userblock for this chunk */
-	switch (type)
-	{
-		case CHUNK_TYPE_LEN8:
-			ptr = flags - sizeof (struct userblock8) * blocknum;
-			break;
-
-		case CHUNK_TYPE_LEN16:
-			ptr = flags - sizeof (struct userblock16) * blocknum;
-			break;
-
-		case CHUNK_TYPE_LEN32:
-			ptr = flags - sizeof (struct userblock32) * blocknum;
-			break;
-	}
-
 	/* Back up to the beginning of the chunk */
-	chunk = (malloc_chunk_t *)(ptr - 6);
+	chunk = (malloc_chunk_t *)((U8 *)flags
+		- blocknum * (chunk_sizes[type] + 1) - offsetof (malloc_chunk_t, data));
 
 	/* Mark the block as available again */
 	chunk->available |= set_bit_mask[blocknum];
+	malloc_stats[type].in_use--;
 
 	/* Note, it is possible that userblocks in this chunk are
 	now free, but the block is still kept by the mallocator
@@ -482,54 +531,11 @@ void malloc_collect_task (void)
 	/* Scan all chunks that are not being used at all.
 	Return these back to the block allocator.
 	When to call this is still debatable... */
-	malloc_chunk_t *chunk, *first;
-	U8 type;
-	U8 res;
+	enum chunk_type type;
 
 	for (type = 0; type < NUM_CHUNK_TYPES; type++)
 	{
-restart:
-		first = chunk = chunk_lists[type];
-		if (first)
-		{
-			do {
-				if (chunk->state == BLOCK_MALLOC+BLOCK_USED)
-				{
-					switch (type)
-					{
-						default:
-						case CHUNK_TYPE_LEN8:
-							res = (chunk->available == ONES_MASK(NUM_8BYTE_BLOCKS));
-							break;
-		
-						case CHUNK_TYPE_LEN16:
-							res = (chunk->available == ONES_MASK(NUM_16BYTE_BLOCKS));
-							break;
-		
-						case CHUNK_TYPE_LEN32:
-							res = (chunk->available == ONES_MASK(NUM_32BYTE_BLOCKS));
-							break;
-					}
-	
-					if (res)
-					{
-						dbprintf ("freeing chunk %p\n", chunk);
-						chunk->prev->next = chunk->next;
-						chunk->next->prev = chunk->prev;
-						if (chunk == first)
-						{
-							if (chunk == chunk->next)
-								chunk_lists[type] = NULL;
-							else
-								chunk_lists[type] = chunk->next;
-						}
-						block_free ((task_t *)chunk);
-						goto restart;
-					}
-				}
-				chunk = chunk->next;
-			} while (chunk != first);
-		}
+		malloc_collect_type (type, FALSE);
 		task_sleep_sec (1);
 	}
 	task_exit ();
@@ -555,9 +561,25 @@ CALLSET_ENTRY (malloc, minute_elapsed)
 /** An indication that a minimum of 'count' buffers, each of
 length 'size', is required by the caller.  This is used
 as an early indicator of memory requirements in order to
-speed up the allocations. */
+speed up the allocations.  Chunks are allocated now for them,
+and the collector will keep that many free from then on. */
 void prealloc (U8 size, U8 count)
 {
+	enum chunk_type type = get_chunk_type_for_size (size);
+	struct malloc_class_stats *stats = &malloc_stats[type];
+
+	if (count > stats->reserve)
+		stats->reserve = count;
+
+	while (malloc_free_blocks (type) < count)
+	{
+		if (!chunk_allocate (type))
+		{
+			if (stats->fails < 0xFF)
+				stats->fails++;
+			break;
+		}
+	}
 }
 
 
@@ -620,15 +642,16 @@ void malloc_test_thread (void)
 /** Initialize the malloc subsystem */
 CALLSET_ENTRY (malloc, init)
 {
-	/* Make sure malloc_chunk fits into a task_t */
+	/* Make sure the largest userblock fits into a task_t */
 	dbprintf ("malloc chunk size: %ld\n", sizeof (malloc_chunk_t));
 	dbprintf ("task_t size: %ld\n", sizeof (task_t));
-	if (sizeof (malloc_chunk_t) > sizeof (task_t))
+	if (chunk_counts[NUM_CHUNK_TYPES-1] == 0)
 	{
 		fatal (ERR_MALLOC);
 	}
 
 	memset (chunk_lists, 0, sizeof (chunk_lists));
+	memset (malloc_stats, 0, sizeof (malloc_stats));
 
 #ifdef MALLOC_TEST
 	task_create_anon (malloc_test_thread);
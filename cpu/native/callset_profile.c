@@ -0,0 +1,111 @@
+/*
+ * Copyright 2011 by Brian Dominy <brian@oddchange.com>
+ *
+ * This file is part of FreeWPC.
+ *
+ * FreeWPC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeWPC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeWPC; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <time.h>
+#include <freewpc.h>
+#include <printf.h>
+
+/* This module counts the calls to each event handler entry, and the time
+	spent in each.  When CONFIG_CALLSET_PROFILE is set, gencallset brackets
+	every call with callset_profile_start and callset_profile_stop, passing
+	the entry's index in callset_profile_names.
+
+	Entries for the same event have consecutive indices, so the per-event
+	totals are found by adding up each run of equal event names.  Every
+	call to an event calls its first entry, unless an earlier boolean
+	entry stopped it, so the count of the first entry is taken as the
+	number of times that the event was invoked. */
+
+extern const U16 callset_profile_count;
+extern const char *const callset_profile_names[][2];
+extern struct callset_profile callset_profile_data[];
+
+
+callset_time_t callset_profile_start (void)
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+void callset_profile_stop (U16 id, callset_time_t start)
+{
+	callset_time_t elapsed = callset_profile_start () - start;
+	struct callset_profile *prof = &callset_profile_data[id];
+
+	prof->calls++;
+	prof->total += elapsed;
+	if (elapsed > prof->max)
+		prof->max = elapsed;
+}
+
+
+/** Print the profile for all events that were called, to a file or
+to the debugger if F is NULL. */
+static void callset_profile_print (FILE *f)
+{
+	U16 id, end;
+	callset_time_t total;
+
+#define cprintf(format, rest...) \
+	do { if (f) fprintf (f, format, ## rest); else dbprintf (format, ## rest); } while (0)
+
+	for (id = 0; id < callset_profile_count; id = end)
+	{
+		total = 0;
+		for (end = id; end < callset_profile_count
+			&& !strcmp (callset_profile_names[end][0], callset_profile_names[id][0]);
+			end++)
+			total += callset_profile_data[end].total;
+
+		if (callset_profile_data[id].calls == 0)
+			continue;
+
+		cprintf ("%s: %lu calls, %llu us\n", callset_profile_names[id][0],
+			callset_profile_data[id].calls, total / 1000);
+		for (; id < end; id++)
+		{
+			struct callset_profile *prof = &callset_profile_data[id];
+			cprintf ("   %-20s %8lu calls %8llu us %6llu us max\n",
+				callset_profile_names[id][1], prof->calls,
+				prof->total / 1000, prof->max / 1000);
+		}
+	}
+#undef cprintf
+}
+
+
+/** Print the profile to the debugger. */
+void callset_profile_dump (void)
+{
+	callset_profile_print (NULL);
+}
+
+
+/** Write the profile to a file. */
+void callset_profile_write (const char *filename)
+{
+	FILE *f = fopen (filename, "w");
+	if (!f)
+		return;
+	callset_profile_print (f);
+	fclose (f);
+}
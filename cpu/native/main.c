@@ -7,6 +7,13 @@ void native_init (void)
 
 void native_exit (void)
 {
+#ifdef CONFIG_RTT_PROFILE
+	rtt_profile_write (RTT_PROFILE_FILE);
+#endif
+#ifdef CONFIG_RTT_RATES
+	rtt_rate_report (&tick_table);
+	rtt_rate_report (&native_rtt_table);
+#endif
 	protected_memory_save ();
 }
 
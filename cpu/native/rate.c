@@ -0,0 +1,172 @@
+/*
+ * Copyright 2012 by Brian Dominy <brian@oddchange.com>
+ *
+ * This file is part of FreeWPC.
+ *
+ * FreeWPC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeWPC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeWPC; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <time.h>
+#include <freewpc.h>
+#include <diag.h>
+#include <native/log.h>
+#ifdef CONFIG_SIM
+#include <simulation.h>
+#endif
+
+/* This module dispatches realtime tasks from rate tables generated by
+	'sched -r', for native builds with CONFIG_RTT_RATES.  Unlike the
+	unrolled interrupt handlers, each task has its own period, phase and
+	deadline in microseconds, so periods need not be powers of 2 or
+	whole ticks.
+
+	Each table keeps its own notion of time, which the realtime loop
+	advances.  Whenever a task is due, the one with the earliest deadline
+	runs first; ties go to the task listed first.  The host time that each
+	call takes is added to the table's 'busy' time, so work that overruns
+	delays the tasks after it, just as on a real CPU.  A call that finishes
+	after its deadline is a miss.  If a task falls so far behind that its
+	next deadline has passed before it could start, that release is
+	skipped and counted as a miss too, rather than being run late.
+
+	Tasks released in the middle of a tick run when the tick is processed,
+	at their release time as far as the statistics are concerned. */
+
+#ifdef CONFIG_SIM
+extern int linux_irq_multiplier;
+#define rate_log(format, rest...) simlog (SLC_DEBUG, format, ## rest)
+#else
+#define linux_irq_multiplier 1
+#define rate_log(format, rest...) print_log (format "\n", ## rest)
+#endif
+
+
+/** The total number of deadline misses in all tables */
+int rtt_deadline_misses;
+
+
+/** Return a monotonic host time in microseconds */
+static unsigned long long rtt_rate_host_time (void)
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+
+void rtt_rate_init (struct rtt_rate_table *table)
+{
+	unsigned int n;
+
+	for (n = 0; n < table->count; n++)
+	{
+		struct rtt_rate *rate = &table->rates[n];
+		rate->release = table->now + rate->phase;
+		rate->runs = rate->misses = rate->max_latency = 0;
+	}
+	table->busy = table->now;
+}
+
+
+/** Return the task that should run next, or NULL if none are due. */
+static struct rtt_rate *rtt_rate_next (struct rtt_rate_table *table)
+{
+	unsigned int n;
+	struct rtt_rate *best = NULL;
+
+	for (n = 0; n < table->count; n++)
+	{
+		struct rtt_rate *rate = &table->rates[n];
+		if (rate->release > table->now)
+			continue;
+		if (!best || rate->release + rate->deadline < best->release + best->deadline)
+			best = rate;
+	}
+	return best;
+}
+
+
+/**
+ * Advance a table's time by USECS, running every task that comes due.
+ * If RUN is false, as when interrupts are disabled, the tasks are held
+ * until a later call.
+ */
+void rtt_rate_advance (struct rtt_rate_table *table, unsigned long usecs, bool run)
+{
+	struct rtt_rate *rate;
+	unsigned long long start, finish, host_start;
+
+	table->now += usecs;
+	if (!run)
+		return;
+
+	/* If earlier calls overran, the CPU is still busy with them */
+	while (table->busy <= table->now && (rate = rtt_rate_next (table)) != NULL)
+	{
+		start = (rate->release > table->busy) ? rate->release : table->busy;
+
+		host_start = rtt_rate_host_time ();
+		rate->fn ();
+		finish = start + (rtt_rate_host_time () - host_start) * linux_irq_multiplier;
+		table->busy = finish;
+
+		rate->runs++;
+		if (start - rate->release > rate->max_latency)
+			rate->max_latency = start - rate->release;
+		if (finish > rate->release + rate->deadline)
+		{
+			rate->misses++;
+			rtt_deadline_misses++;
+		}
+
+		rate->release += rate->period;
+		while (rate->release + rate->deadline < table->busy)
+		{
+			rate->release += rate->period;
+			rate->misses++;
+			rtt_deadline_misses++;
+		}
+	}
+
+	if (table->busy < table->now)
+		table->busy = table->now;
+}
+
+
+void rtt_rate_report (struct rtt_rate_table *table)
+{
+	unsigned int n;
+
+	for (n = 0; n < table->count; n++)
+	{
+		struct rtt_rate *rate = &table->rates[n];
+		rate_log ("%-24s %8luus %8lu runs %6lu misses %6luus latency",
+			rate->name, rate->period, rate->runs, rate->misses, rate->max_latency);
+	}
+}
+
+
+CALLSET_ENTRY (native_rate, diagnostic_check)
+{
+	if (rtt_deadline_misses)
+		diag_post_error ("RTT DEADLINE\nMISSED\n", SYS_PAGE);
+}
+
+#ifdef CONFIG_SIM
+CALLSET_ENTRY (native_rate, init)
+{
+	conf_add ("rtt.misses", &rtt_deadline_misses);
+}
+#endif
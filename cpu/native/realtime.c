@@ -35,6 +35,13 @@ extern void do_irq (void);
  */
 unsigned long realtime_counter;
 
+#ifdef CONFIG_SIM
+/* In simulation, the clock can be made to run faster than real time. */
+extern int linux_irq_multiplier;
+#else
+#define linux_irq_multiplier 1
+#endif
+
 
 /**
  * Returns the current simulation time.
@@ -44,6 +51,40 @@ unsigned long realtime_read (void)
 	return realtime_counter;
 }
 
+#ifdef CONFIG_RTT_RATES
+#ifdef CONFIG_FIRQ
+void native_firq_rtt (void)
+{
+	if (linux_firq_enable)
+		do_firq ();
+}
+#endif
+
+void native_periodic_rtt (void)
+{
+	db_periodic ();
+	if (likely (periodic_ok))
+		do_periodic ();
+}
+
+
+/** Realtime callback function.
+ *
+ * This event simulates an elapsed 1ms.  The RTTs, the FIRQ and periodic
+ * processing are all released from rate tables generated by the
+ * scheduler.
+ */
+void realtime_tick (void)
+{
+#ifdef CONFIG_SIM
+	sim_time_step ();
+#endif
+	rtt_rate_advance (&tick_table, 1000, linux_irq_enable);
+	rtt_rate_advance (&native_rtt_table, 1000, TRUE);
+}
+
+#else
+
 /** Realtime callback function.
  *
  * This event simulates an elapsed 1ms.
@@ -92,6 +133,20 @@ void realtime_tick (void)
 		next_periodic_time += PERIODIC_FREQ;
 	}
 }
+#endif /* CONFIG_RTT_RATES */
+
+
+/**
+ * Advance the simulation time by one real millisecond.
+ */
+static void realtime_advance (void)
+{
+	int n = linux_irq_multiplier;
+	do {
+		realtime_counter++;
+		realtime_tick ();
+	} while (--n > 0);
+}
 
 
 /**
@@ -110,6 +165,10 @@ void realtime_loop (void)
 	int latency;
 #endif
 
+#ifdef CONFIG_RTT_RATES
+	native_rtt_init ();
+#endif
+
 	gettimeofday (&prev_time, NULL);
 	for (;;)
 	{
@@ -161,8 +220,7 @@ void realtime_loop (void)
 		/* Invoke realtime tick at least once every time through the loop.
 		So if we slept < 1ms (either the OS lied to us, or we didn't sleep at all),
 		we'll make forward progress. */
-		realtime_counter++;
-		realtime_tick ();
+		realtime_advance ();
 		usecs_elapsed -= usecs_asked;
 
 		if (usecs_elapsed > 20000)
@@ -172,8 +230,7 @@ void realtime_loop (void)
 		/* If any remaining millseconds occurred during the wait, handle them */
 		while (usecs_elapsed >= 1000)
 		{
-			realtime_counter++;
-			realtime_tick ();
+			realtime_advance ();
 			usecs_elapsed -= 1000;
 		}
 
@@ -0,0 +1,100 @@
+/*
+ * Copyright 2012 by Brian Dominy <brian@oddchange.com>
+ *
+ * This file is part of FreeWPC.
+ *
+ * FreeWPC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeWPC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeWPC; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <time.h>
+#include <freewpc.h>
+
+/* This module measures how long each realtime task takes to run.
+	When CONFIG_RTT_PROFILE is set, the scheduler brackets every call in
+	the generated interrupt handlers with rtt_profile_begin and
+	rtt_profile_end, passing the task's index in tick_profile_names.
+
+	At exit, the average and worst-case cost of each task is written out
+	in microseconds, in a form that the scheduler accepts with -c. */
+
+/* This must be at least the scheduler's MAX_TASKS */
+#define MAX_RTT_PROFILE 64
+
+struct rtt_cost
+{
+	unsigned long calls;
+	unsigned long long total;
+	unsigned long long max;
+};
+
+extern const unsigned int tick_profile_count;
+extern const char *tick_profile_names[];
+
+static struct rtt_cost rtt_costs[MAX_RTT_PROFILE];
+
+static unsigned long long rtt_profile_start;
+
+
+/** Return a monotonic time in nanoseconds */
+static unsigned long long rtt_profile_now (void)
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+void rtt_profile_begin (void)
+{
+	rtt_profile_start = rtt_profile_now ();
+}
+
+
+void rtt_profile_end (unsigned int id)
+{
+	unsigned long long elapsed = rtt_profile_now () - rtt_profile_start;
+	struct rtt_cost *cost;
+
+	if (id >= MAX_RTT_PROFILE)
+		return;
+	cost = &rtt_costs[id];
+	cost->calls++;
+	cost->total += elapsed;
+	if (elapsed > cost->max)
+		cost->max = elapsed;
+}
+
+
+/** Write the measured costs of all tasks that ran at least once. */
+void rtt_profile_write (const char *filename)
+{
+	FILE *f;
+	unsigned int id;
+
+	f = fopen (filename, "w");
+	if (!f)
+		return;
+
+	fprintf (f, "# task average worst calls\n");
+	for (id = 0; id < tick_profile_count && id < MAX_RTT_PROFILE; id++)
+	{
+		struct rtt_cost *cost = &rtt_costs[id];
+		if (cost->calls == 0)
+			continue;
+		fprintf (f, "%s %.3fu %.3fu %lu\n", tick_profile_names[id],
+			cost->total / 1000.0 / cost->calls, cost->max / 1000.0, cost->calls);
+	}
+	fclose (f);
+}
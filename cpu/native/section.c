@@ -18,6 +18,10 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <freewpc.h>
 #undef sprintf
 #include <native/log.h>
@@ -28,60 +32,310 @@
  *
  * Protected memory variables can be detected because they reside in a special
  * section of the output file (in much the same way that the 6809 compile does
- * it).  The entire block of RAM can be read from/written to a file to
- * provide persistence.
+ * it).  The entire block of RAM is kept in a file to provide persistence.
+ *
+ * The file is an image of the block, mapped into memory.  It is not
+ * written on every change, since a crash in the middle of a write would
+ * lose or corrupt it.  Instead, the block is compared to a shadow copy
+ * every 100ms, and each range of bytes that changed is appended to a
+ * journal file.  Ranges that are close together are written as one
+ * record.  The journal is flushed to disk once a second, if anything was
+ * added to it.
+ *
+ * When the journal grows large, it is compacted: the image is brought up
+ * to date a piece at a time, once a second, and when it is current it is
+ * synced and the journal is emptied.  At exit, this is all done at once.  At
+ * startup, the records in the journal are applied to the image again.  A
+ * record that was only partly written fails its checksum, and it and
+ * anything after it are ignored.
  */
 
 /** The name of the backing file */
 char protected_memory_file[256] = "nvram/default.nv";
 
+/** The name of the journal of changes not yet in the backing file */
+char protected_journal_file[256] = "nvram/default.nvj";
+
+/** The header of each journal record.  It is followed by 'len' bytes of
+data, to be stored at 'offset' within the block. */
+struct journal_record
+{
+	U16 magic;
+	U16 offset;
+	U16 len;
+	U16 csum;
+};
+
+#define JOURNAL_MAGIC 0x4A4E
+
+/** Changed ranges closer than this are written as one record */
+#define JOURNAL_MERGE_GAP 8
+
+/** Compact the journal when it grows beyond this size */
+#define JOURNAL_COMPACT_SIZE 0x4000
+
+/** The image is brought up to date this many bytes at a time, one
+piece per idle call, so that a compaction never holds up the game */
+#define COMPACT_CHUNK_SIZE 256
+
+/** The image of the block in the backing file, or NULL if it could
+not be mapped */
+static U8 *protected_image;
+
+/** The contents of the block as of the last journal record */
+static U8 *protected_shadow;
+
+/** A buffer for building a journal record */
+static U8 *journal_buffer;
+
+static int image_fd = -1;
+static int journal_fd = -1;
+
+/** The number of bytes in the journal */
+static off_t journal_size;
+
+/** True if records have been written since the journal was last flushed */
+static bool journal_dirty;
+
+/** For each COMPACT_CHUNK_SIZE piece of the block, true if the image
+is older than the shadow copy there */
+static bool *compact_pending;
+
+/** The number of entries in compact_pending */
+static int compact_chunks;
+
+/** True while an incremental compaction is under way */
+static bool compacting;
+
+
+static U16 journal_csum (const struct journal_record *rec, const U8 *data)
+{
+	U16 csum = rec->offset + rec->len;
+	U16 n;
+
+	for (n = 0; n < rec->len; n++)
+		csum = (csum << 1 | csum >> 15) + data[n];
+	return csum;
+}
+
+
+/** Apply the records in the journal to the image.  Returns the number
+of records applied. */
+static int journal_replay (int size)
+{
+	struct journal_record rec;
+	int count = 0;
+
+	while (read (journal_fd, &rec, sizeof (rec)) == sizeof (rec))
+	{
+		if (rec.magic != JOURNAL_MAGIC || rec.offset + rec.len > size
+			|| read (journal_fd, journal_buffer, rec.len) != rec.len
+			|| journal_csum (&rec, journal_buffer) != rec.csum)
+		{
+			print_log ("Ignoring partial journal record\n");
+			break;
+		}
+		memcpy (protected_image + rec.offset, journal_buffer, rec.len);
+		count++;
+	}
+	return count;
+}
+
+
+/** Write all pending records to disk. */
+static void journal_flush (void)
+{
+	if (journal_dirty)
+	{
+		fdatasync (journal_fd);
+		journal_dirty = FALSE;
+	}
+}
+
+
+/** Mark the pieces of the image covering 'len' bytes at 'offset' as
+out of date. */
+static void compact_mark (int offset, int len)
+{
+	int n;
+
+	for (n = offset / COMPACT_CHUNK_SIZE;
+		n <= (offset + len - 1) / COMPACT_CHUNK_SIZE; n++)
+		compact_pending[n] = TRUE;
+}
+
+
+/** Copy one out of date piece of the shadow copy to the image.  Returns
+FALSE if the image was already up to date. */
+static bool compact_step (void)
+{
+	int size = AREA_SIZE(nvram);
+	int n, offset, len;
+
+	for (n = 0; n < compact_chunks; n++)
+		if (compact_pending[n])
+		{
+			offset = n * COMPACT_CHUNK_SIZE;
+			len = size - offset < COMPACT_CHUNK_SIZE ? size - offset : COMPACT_CHUNK_SIZE;
+			memcpy (protected_image + offset, protected_shadow + offset, len);
+			compact_pending[n] = FALSE;
+			return TRUE;
+		}
+	return FALSE;
+}
+
+
+/** Empty the journal, once the image is up to date. */
+static void compact_finish (void)
+{
+	msync (protected_image, AREA_SIZE(nvram), MS_SYNC);
+	if (ftruncate (journal_fd, 0) == 0)
+	{
+		fsync (journal_fd);
+		journal_size = 0;
+	}
+	compacting = FALSE;
+}
+
+
+/** Bring the image up to date and empty the journal, all at once.  The
+journal is flushed first, so that a crash while the image is being
+written can be recovered by applying the journal again. */
+static void journal_compact (void)
+{
+	journal_flush ();
+	while (compact_step ())
+		;
+	compact_finish ();
+}
+
+
+/** Append a record for 'len' bytes at 'offset' in the block. */
+static void journal_write (U16 offset, U16 len)
+{
+	struct journal_record *rec = (struct journal_record *)journal_buffer;
+
+	rec->magic = JOURNAL_MAGIC;
+	rec->offset = offset;
+	rec->len = len;
+	memcpy (journal_buffer + sizeof (*rec), (U8 *)AREA_BASE(nvram) + offset, len);
+	rec->csum = journal_csum (rec, journal_buffer + sizeof (*rec));
+
+	if (write (journal_fd, journal_buffer, sizeof (*rec) + len) != sizeof (*rec) + len)
+		print_log ("Warning: could not write to journal\n");
+	journal_size += sizeof (*rec) + len;
+	journal_dirty = TRUE;
+}
+
+
+/** Compare the block to the shadow copy, and journal whatever changed. */
+static void protected_memory_sync (void)
+{
+	U8 *mem = (U8 *)AREA_BASE(nvram);
+	int size = AREA_SIZE(nvram);
+	int start, end, n;
+
+	if (!protected_image)
+		return;
+
+	for (n = 0; n < size; )
+	{
+		if (mem[n] == protected_shadow[n])
+		{
+			n++;
+			continue;
+		}
+
+		/* Extend the range until JOURNAL_MERGE_GAP bytes in a row are
+		unchanged */
+		start = end = n;
+		while (n < size && n - end < JOURNAL_MERGE_GAP)
+		{
+			if (mem[n] != protected_shadow[n])
+				end = n;
+			n++;
+		}
+
+		journal_write (start, end - start + 1);
+		memcpy (protected_shadow + start, mem + start, end - start + 1);
+		compact_mark (start, end - start + 1);
+	}
+}
+
 
 /** Load the contents of the protected memory from file to RAM. */
 void protected_memory_load (void)
 {
 	int size = AREA_SIZE(nvram);
-	FILE *fp;
+	struct stat st;
+	int count;
 
 	/* Use a different file for each machine */
 	sprintf (protected_memory_file, "nvram/%s.nv", MACHINE_SHORTNAME);
+	sprintf (protected_journal_file, "nvram/%s.nvj", MACHINE_SHORTNAME);
 
 	print_log ("Loading protected memory from '%s'\n", protected_memory_file);
-	fp = fopen (protected_memory_file, "r");
-	if (fp)
-	{
-		fread (AREA_BASE(nvram), 1, size, fp);
-		fclose (fp);
-	}
-	else
+	image_fd = open (protected_memory_file, O_RDWR | O_CREAT, 0666);
+	journal_fd = open (protected_journal_file, O_RDWR | O_CREAT | O_APPEND, 0666);
+	if (image_fd < 0 || journal_fd < 0 || fstat (image_fd, &st) < 0
+		|| (st.st_size != size && ftruncate (image_fd, size) < 0)
+		|| (protected_image = mmap (NULL, size, PROT_READ | PROT_WRITE,
+			MAP_SHARED, image_fd, 0)) == MAP_FAILED)
 	{
 		print_log ("Error loading memory, using defaults\n");
+		protected_image = NULL;
 		memset (AREA_BASE(nvram), 0, size);
+		return;
 	}
+
+	protected_shadow = malloc (size);
+	journal_buffer = malloc (sizeof (struct journal_record) + size);
+	compact_chunks = (size + COMPACT_CHUNK_SIZE - 1) / COMPACT_CHUNK_SIZE;
+	compact_pending = calloc (compact_chunks, sizeof (bool));
+
+	count = journal_replay (size);
+	if (count)
+		print_log ("Applied %d journal records\n", count);
+
+	memcpy (AREA_BASE(nvram), protected_image, size);
+	memcpy (protected_shadow, protected_image, size);
+	journal_compact ();
 }
 
 
 /** Save the contents of the protected memory from RAM to a file. */
 void protected_memory_save (void)
 {
-	int size = AREA_SIZE(nvram);
-	FILE *fp;
-
-	print_log ("Saving 0x%X bytes of protected memory to %s\n", size, protected_memory_file);
-	fp = fopen (protected_memory_file, "w");
-	if (fp)
-	{
-		if (fwrite (AREA_BASE(nvram), 1, size, fp) < size)
-		{
-			print_log ("Warning: could not save all of memory\n");
-			task_sleep_sec (1);
-		}
-		fclose (fp);
-	}
-	else
+	if (!protected_image)
 	{
 		print_log ("Warning: could not write to memory file\n");
-		task_sleep_sec (1);
+		return;
 	}
+
+	print_log ("Saving 0x%X bytes of protected memory to %s\n",
+		AREA_SIZE(nvram), protected_memory_file);
+	protected_memory_sync ();
+	journal_compact ();
+}
+
+
+CALLSET_ENTRY (native_nvram, idle_every_100ms)
+{
+	protected_memory_sync ();
 }
 
 
+CALLSET_ENTRY (native_nvram, idle_every_second)
+{
+	if (!protected_image)
+		return;
+
+	/* Compact a piece at a time.  The journal is flushed before each
+	piece, so every change copied to the image is also in the journal
+	until it is emptied. */
+	journal_flush ();
+	if (journal_size > JOURNAL_COMPACT_SIZE)
+		compacting = TRUE;
+	if (compacting && !compact_step ())
+		compact_finish ();
+}
@@ -102,6 +102,9 @@ typedef struct
 	audit_t exec_lockups; /* done */
 	audit_t trough_rescues;
 	audit_t chase_balls;
+	audit_t sound_queue_max; /* done */
+	audit_t sound_drops; /* done */
+	audit_t tasks_shed; /* done */
 	time_audit_t total_game_time; /* done */
 	audit_t hist_score[13];
 	audit_t hist_game_time[13];
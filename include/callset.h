@@ -29,13 +29,60 @@
 #define CALLSET_BOOL_ENTRY(module,set) \
 	bool module ## _ ## set (void)
 
-#define callset_invoke(set)	SECTION_VOIDCALL(__event__, callset_ ## set)
+/* gencallset writes a CALLSET_EMPTY_<set> macro, expanding to '~, 1', for
+each event that has no entries.  CALLSET_EMPTY_P tests for it, giving 1 if
+it is defined and 0 otherwise, so that invoking such an event generates
+no code at all. */
+#include <callset_empty.h>
 
-#define callset_invoke_boolean(set)	\
+#define CALLSET_EMPTY_P(probe)	CALLSET_SECOND (probe, 0, ~)
+#define CALLSET_SECOND(a, b, ...)	b
+
+#define callset_invoke(set) \
+	CALLSET_INVOKE (CALLSET_EMPTY_P (CALLSET_EMPTY_ ## set), callset_ ## set)
+#define CALLSET_INVOKE(empty, fn)	CALLSET_INVOKE_(empty, fn)
+#define CALLSET_INVOKE_(empty, fn)	CALLSET_INVOKE_ ## empty (fn)
+#define CALLSET_INVOKE_0(fn)	SECTION_VOIDCALL(__event__, fn)
+#define CALLSET_INVOKE_1(fn)	do { } while (0)
+
+#define callset_invoke_boolean(set) \
+	CALLSET_INVOKE_BOOL (CALLSET_EMPTY_P (CALLSET_EMPTY_ ## set), callset_ ## set)
+#define CALLSET_INVOKE_BOOL(empty, fn)	CALLSET_INVOKE_BOOL_(empty, fn)
+#define CALLSET_INVOKE_BOOL_(empty, fn)	CALLSET_INVOKE_BOOL_ ## empty (fn)
+#define CALLSET_INVOKE_BOOL_0(fn) \
 ({ \
-	extern __event__ bool callset_ ## set (void); \
-	callset_ ## set (); \
+	extern __event__ bool fn (void); \
+	fn (); \
 })
+#define CALLSET_INVOKE_BOOL_1(fn)	TRUE
+
+/* CALLSET_PRIORITY, on a line before a CALLSET_ENTRY, tells gencallset to
+call that entry before others with a lower priority.  The default is 0. */
+#define CALLSET_PRIORITY(n)
+
+/* With CONFIG_CALLSET_PROFILE, gencallset times each call to an entry.
+Native builds count the calls and the time spent in each.  The 6809 has
+no cheap timer for this, so gencallset is not asked to profile there;
+build with CONFIG_PROFILE to use the mcount hook instead. */
+#ifdef CONFIG_CALLSET_PROFILE
+#ifdef CONFIG_NATIVE
+typedef unsigned long long callset_time_t;
+
+struct callset_profile
+{
+	unsigned long calls;
+	callset_time_t total;
+	callset_time_t max;
+};
+
+callset_time_t callset_profile_start (void);
+void callset_profile_stop (U16 id, callset_time_t start);
+void callset_profile_dump (void);
+void callset_profile_write (const char *filename);
+#else
+#define callset_profile_dump()
+#endif
+#endif /* CONFIG_CALLSET_PROFILE */
 
 /* WARNING : this function won't work if the caller is in a different page
 from EVENT_PAGE. */
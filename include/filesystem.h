@@ -49,6 +49,9 @@ enum file_type
 	FT_FLEX1,
 	FT_FLEX2,
 	FT_FLEX3,
+
+	/* The number of file types.  New types go just above this. */
+	NUM_FILE_TYPES
 };
 
 
@@ -73,31 +76,53 @@ struct area_csum
 	/** A version identifier for the structure */
 	U8 version;
 
+	/** Options for how the block is checked; see CSUM_CRC16 */
+	U8 flags;
+
 	/** A function that will reset the block to factory defaults.
 	    This must reside within the same page as the caller to the
 		 csum module. */
 	void (*reset) (void);
+
+	/** An optional function that converts the block when the version
+	    saved in the file table is older than 'version'.  It is given the
+		 old version and length, and returns TRUE if it converted the
+		 block in place; otherwise the block is reset.  It is only called
+		 if the block did not move and its old checksum is good.  The
+		 same page rules apply as for 'reset'. */
+	bool (*migrate) (U8 old_version, U8 old_length);
 };
 
 
 
+/** Set in area_csum.flags to check the block with a CRC-16 instead of an
+8-bit sum.  This catches more kinds of damage, but every change to the
+block must recompute it.  Use it for large blocks that rarely change. */
+#define CSUM_CRC16 0x1
+
+
 struct file_info
 {
 	enum file_type type;
+	/* The area_csum flags that 'csum' was computed with */
 	U8 attr : 4;
 	U8 version : 4;
 	void *data;
 	size_t len;
 	U8 csum;
-	U8 reserved;
+	U8 csum_hi;
 };
 
 
 struct file_info *file_find (enum file_type type);
+struct file_info *file_create (enum file_type type);
 void file_init (void);
 void file_reset (void);
 void file_register (const struct area_csum *csi);
 
 void csum_area_update (const struct area_csum *csi);
+void csum_area_update_byte (const struct area_csum *csi, U8 old_val, U8 new_val);
+void csum_area_update_word (const struct area_csum *csi, U16 old_val, U16 new_val);
 void csum_area_reset (const struct area_csum *csi);
 void csum_area_check (const struct area_csum *csi);
+bool csum_file_valid (const struct file_info *fi);
@@ -34,6 +34,29 @@
 struct ball;
 struct ball_node;
 
+/*	A path is one of several weighted ways out of a node, as loaded
+	from the machine's graph file.  When a node has paths, a kick picks
+	one of them at random in proportion to its weight, and the travel
+	time is drawn from a distribution about the given delay. */
+struct ball_path
+{
+	/* Where the ball goes */
+	struct ball_node *dst;
+
+	/* The relative likelihood of this path */
+	unsigned int weight;
+
+	/* The mean travel time in milliseconds, and how far either way
+	of the mean it can vary */
+	unsigned int delay;
+	unsigned int spread;
+
+	/* The number of times this path has been taken */
+	unsigned long count;
+
+	struct ball_path *next;
+};
+
 /*	The node type is used to subclass a node's behavior. */
 struct ball_node_type
 {
@@ -89,6 +112,16 @@ struct ball_node
 	to the next node automatically */
 	unsigned int unlocked;
 
+	/* Weighted paths out of this node, and the sum of their weights.
+	If there are none, then 'next' and 'delay' are used. */
+	struct ball_path *paths;
+	unsigned int path_weight;
+
+	/* When autoplay is enabled, how long a ball stays here before it
+	is kicked automatically, as if by the player.  Zero means never. */
+	unsigned int hold;
+	unsigned int hold_spread;
+
 	/* The name of the node used for debugging */
 	const char *name;
 };
@@ -100,7 +133,7 @@ struct ball
 {
 	struct ball_node *node;
 	unsigned int pos;
-	int timer;
+	struct time_handler *timer;
 	unsigned int flags;
 	unsigned int index;
 	char name[32];
@@ -131,13 +164,23 @@ extern struct ball_node_type open_type_node;
 
 extern struct ball the_ball[];
 
+extern int sim_autoplay;
+extern int graph_shot_count;
+
 void node_insert (struct ball_node *node, struct ball *ball);
-void node_kick (struct ball_node *node);
-void node_move (struct ball_node *dst, struct ball_node *src);
+bool node_kick (struct ball_node *node);
+bool node_move (struct ball_node *dst, struct ball_node *src);
+bool node_move_delay (struct ball_node *dst, struct ball_node *src, unsigned int delay);
 void node_join (struct ball_node *source, struct ball_node *sink, unsigned int delay);
 void node_init (void);
 void node_insert_delay (struct ball_node *dst, struct ball *ball, unsigned int delay);
+struct ball_node *node_insert_cancel (struct ball *ball);
 
 void mux_type_insert (struct ball_node *node, struct ball *ball);
 
+void graph_load (const char *filename);
+struct ball_path *graph_choose (struct ball_node *node);
+unsigned int graph_sample (unsigned int delay, unsigned int spread);
+void graph_report (void);
+
 #endif /* _HWSIM_BALL_H */
@@ -114,6 +114,7 @@ typedef double (*value_signal) (uint32_t offset);
 extern unsigned int signo_under_trace;
 
 void signal_update (signal_number_t signo, unsigned int state);
+bool signal_read (uint32_t signo);
 void signal_init (void);
 void signal_capture_start (struct signal_expression *ex);
 void signal_capture_stop (struct signal_expression *ex);
@@ -23,34 +23,109 @@
 
 struct log_event
 {
-	/* The number of 100ms ticks since the last event was logged.
-	This can be as large as 250, for 25 seconds.  A value of 0xFF
-	means that more than 25 seconds elapsed. */
+	/* The time since the previous event was logged.  Below
+	LOG_TS_COARSE, this is in 16ms ticks.  Otherwise, the low 7 bits
+	are in units of 64 ticks, about 1 second; a value of 0xFF means
+	that two minutes or more elapsed. */
 	U8 timestamp;
 
-	/* The module ID (upper 4-bits) and event ID (lower 4-bits) */
+	/* The module ID (upper 8-bits) and event ID (lower 8-bits), or
+	LOG_EMPTY if the slot has not been written */
 	U16 module_event;
 
 	/* An event-specific 8-bit argument */
 	U8 arg;
 };
 
+#define LOG_TS_COARSE 0x80
+#define LOG_TS_COARSE_SHIFT 6
+
+/* Convert a timestamp back to a number of 16ms ticks */
+#define log_timestamp_ticks(ts) \
+	(((ts) < LOG_TS_COARSE) ? (U16)(ts) \
+		: (U16)((ts) & ~LOG_TS_COARSE) << LOG_TS_COARSE_SHIFT)
+
+#define LOG_EMPTY 0xFFFFUL
+
+/* The event log is exported as LOG_EXPORT_MAGIC, followed by each
+event from oldest to newest as 4 bytes: timestamp, module, event and
+argument.  tools/logdecode prints it. */
+#define LOG_EXPORT_MAGIC "FWL1"
+
 #define MAX_LOG_EVENTS 128
 
+/* With CONFIG_SWITCH_TRACE, the stages of each switch event are timed,
+from the scan that first saw it until its handler returned. */
+#define SW_TRACE_STAGES 4
+
+struct switch_trace
+{
+	/* The switch number, or SW_TRACE_NONE if it was not traced */
+	U8 sw;
+
+	/* The switch scan that first saw the new reading.  Scans are
+	counted by switch_trace_clock, every 2ms. */
+	U16 raw;
+
+	/* The number of scans after 'raw' that each later stage was
+	reached.  These stop counting at 255. */
+	U8 at[SW_TRACE_STAGES];
+};
+
+/* The stages of a switch trace after the raw reading */
+#define SW_TRACE_STABLE 0      /* same reading on two scans */
+#define SW_TRACE_DEBOUNCED 1   /* debounce complete, event scheduled */
+#define SW_TRACE_START 2       /* dispatcher started processing it */
+#define SW_TRACE_END 3         /* handler returned */
+
+#define SW_TRACE_NONE 0xFF
+
+#define MAX_SWITCH_TRACES 64
+
 extern void log_init (void);
 extern void log_event1(U16 module_event, U8 arg);
 extern __permanent__ U16 prev_log_callset;
+#ifdef CONFIG_LOG
+extern U16 log_module_mask;
+extern void log_export (void (*put) (U8));
+extern void log_dump (void);
+#ifdef CONFIG_NATIVE
+extern void log_write (const char *filename);
+#endif
+#endif
+#ifdef CONFIG_SWITCH_TRACE
+extern void switch_trace_log (const struct switch_trace *trace);
+extern void switch_trace_dump (void);
+#endif
 
-/* Logging has been disabled by default, as this feature has not
-been used and is not very useful.  It can be turned back on via
-CONFIG_LOG if anyone cares. */
+/* Logging is disabled by default.  It can be turned on via
+CONFIG_LOG.  An event is only logged if its module's
+bit is set in log_module_mask, and it is no less severe than
+MIN_SEVERITY.  Both are tested here, before the call, so that an
+event which is not wanted costs no more than the test. */
 #ifdef CONFIG_LOG
 #define log_event(severity, module, event, arg) \
-	log_event1(make_module_event (module, event), arg)
+	do { \
+		if ((severity) <= MIN_SEVERITY \
+			&& (log_module_mask & log_module_bit (module))) \
+			log_event1(make_module_event (module, event), arg); \
+	} while (0)
 #else
 #define log_event(severity, module, event, arg)
 #endif
 
+#define log_module_bit(module) ((U16)(1UL << (module)))
+
+/* The modules logged at startup.  Task events are left out, since
+there are so many of them that they would soon push everything
+else out of the log. */
+#ifndef LOG_DEFAULT_MODULES
+#define LOG_DEFAULT_MODULES ((U16)~log_module_bit (MOD_TASK))
+#endif
+
+#define log_enable_module(module) (log_module_mask |= log_module_bit (module))
+#define log_disable_module(module) (log_module_mask &= ~log_module_bit (module))
+
 #define make_module_event(module, event) (((U16)(module) << 8UL) | event)
 #define module_part(module_event) ((U8)((module_event) >> 8))
 #define event_part(module_event) ((U8)((module_event) & 0xFF))
@@ -64,7 +139,9 @@ CONFIG_LOG if anyone cares. */
 #define SEV_INFO 2
 #define SEV_DEBUG 3
 
+#ifndef MIN_SEVERITY
 #define MIN_SEVERITY SEV_DEBUG
+#endif
 
 
 #define EV_START 0
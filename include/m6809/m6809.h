@@ -101,8 +101,7 @@ do { \
 	asm ("jsr\t_far_call_pointer_handler"); \
 } while (0);
 
-void *malloc (U8 size);
-void free (void *ptr);
+#include <m6809/malloc.h>
 
 
 extern inline void set_stack_pointer (const U16 s)
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2011 by Brian Dominy <brian@oddchange.com>
+ *
+ * This file is part of FreeWPC.
+ *
+ * FreeWPC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeWPC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeWPC; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _M6809_MALLOC_H
+#define _M6809_MALLOC_H
+
+/* Dynamic memory allocation on the 6809, see cpu/m6809/malloc.c */
+
+/** The number of size classes used by malloc() */
+#define NUM_MALLOC_CLASSES 7
+
+/** Usage counters for one malloc() size class */
+struct malloc_class_stats
+{
+	/** The number of successful allocations */
+	U16 allocs;
+
+	/** The number of times that a new chunk was needed, but
+	could not be had */
+	U8 fails;
+
+	/** The number of chunks owned by the class */
+	U8 chunks;
+
+	/** The number of userblocks allocated now */
+	U16 in_use;
+
+	/** The most userblocks ever allocated at once */
+	U16 peak;
+
+	/** The most userblocks allocated since the last collection */
+	U16 recent;
+
+	/** The number of userblocks requested by prealloc() */
+	U8 reserve;
+};
+
+extern const U8 chunk_sizes[];
+extern struct malloc_class_stats malloc_stats[];
+
+void *malloc (U8 size);
+void free (void *ptr);
+void prealloc (U8 size, U8 count);
+void malloc_collect_all (void);
+void malloc_stats_dump (void);
+
+#endif /* _M6809_MALLOC_H */
@@ -36,7 +36,7 @@
 /** Return the runtime size of a linker area.  This has type U16.
  * This is not the maximum allowable space for the area, but rather
  * reflects how many actual variables have been mapped there. */
-#define AREA_SIZE(name) ((U16)( (int)AREA_END(name) - (int)AREA_BASE(name) ))
+#define AREA_SIZE(name) ((U16)( (U8 *)AREA_END(name) - (U8 *)AREA_BASE(name) ))
 
 /* Define externs for all of these areas.  AREA_BASE and AREA_SIZE can
  * only be called on these. */
@@ -48,6 +48,24 @@ AREA_DECL(stack)
 AREA_DECL(permanent)
 AREA_DECL(nvram)
 
+#include <native/rate.h>
+
+#ifdef CONFIG_RTT_PROFILE
+/** The file to which measured RTT costs are written at exit */
+#define RTT_PROFILE_FILE "build/rtt.cost"
+
+void rtt_profile_write (const char *filename);
+#endif
+
+#ifdef CONFIG_CALLSET_PROFILE
+/** The file to which the event handler profile is written at exit */
+#define CALLSET_PROFILE_FILE "build/callset.prof"
+#endif
+
+#ifdef CONFIG_LOG
+/** The file to which the event log is exported at exit */
+#define LOG_FILE "build/event.log"
+#endif
 
 #endif /* _NATIVE_NATIVE_H */
 
@@ -0,0 +1,68 @@
+/*
+ * Copyright 2012 by Brian Dominy <brian@oddchange.com>
+ *
+ * This file is part of FreeWPC.
+ *
+ * FreeWPC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeWPC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeWPC; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __NATIVE_RATE_H
+#define __NATIVE_RATE_H
+
+/** A realtime task released at its own rate by the native dispatcher.
+The first five fields are generated by 'sched -r'; all times are in
+microseconds. */
+struct rtt_rate
+{
+	void (*fn) (void);
+	unsigned long period;
+	unsigned long phase;
+	unsigned long deadline;
+	const char *name;
+
+	/* The time of the next release */
+	unsigned long long release;
+
+	/* Statistics */
+	unsigned long runs;
+	unsigned long misses;
+	unsigned long max_latency;
+};
+
+struct rtt_rate_table
+{
+	struct rtt_rate *rates;
+	unsigned int count;
+
+	/* The current time */
+	unsigned long long now;
+
+	/* The time at which the last task run finished */
+	unsigned long long busy;
+};
+
+/* The tables generated from the system and native schedules */
+extern struct rtt_rate_table tick_table;
+extern struct rtt_rate_table native_rtt_table;
+
+extern int rtt_deadline_misses;
+
+void native_rtt_init (void);
+
+void rtt_rate_init (struct rtt_rate_table *table);
+void rtt_rate_advance (struct rtt_rate_table *table, unsigned long usecs, bool run);
+void rtt_rate_report (struct rtt_rate_table *table);
+
+#endif /* __NATIVE_RATE_H */
@@ -22,7 +22,10 @@
 #define _PRINTF_H
 
 /* TODO : much of this is implementing a 'varargs' type facility.
- * Split that into a separate header. */
+ * Split that into a separate header.  A host program that builds
+ * kernel/printf.c with STANDALONE uses the C library's stdarg.h
+ * instead. */
+#ifndef STANDALONE
 
 /** va_list is just a byte pointer onto the stack */
 typedef U8 *va_list;
@@ -48,6 +51,8 @@ do { \
 /** Ends a variable argument list access.  Nothing required. */
 #define va_end(va)
 
+#endif /* STANDALONE */
+
 
 
 /** The size of the single print buffer */
@@ -64,6 +69,54 @@ void freewpc_sprintf (const char *format, ...);
 #define printf printf_is_bad
 void sprintf (const char *format, ...);
 #endif
+
+/** One step of a compiled format.  sprintf compiles its format into
+ * a list of these before printing, and keeps the list for the last
+ * format used, so printing the same format again skips the parsing.
+ * A format that is printed often can also be written as a constant
+ * list with the SPF_ macros below and printed with sprintf_plan. */
+struct sprintf_op
+{
+	/** One of the SPF_ types, plus SPF_ZEROES or SPF_STAR */
+	U8 type;
+
+	/** The field width, as given in the format, or the length of
+	 * the text for SPF_COPY */
+	U8 width;
+
+	/** The text for SPF_COPY */
+	const char *text;
+};
+
+#define SPF_END           0   /* end of the plan */
+#define SPF_COPY          1   /* literal text */
+#define SPF_APPEND        2   /* %E */
+#define SPF_DECIMAL       3   /* %d, %i */
+#define SPF_LONG_DECIMAL  4   /* %ld */
+#define SPF_HEX           5   /* %x */
+#define SPF_LONG_HEX      6   /* %lx */
+#define SPF_HEX32         7   /* %w */
+#define SPF_BCD           8   /* %b */
+#define SPF_STRING        9   /* %s */
+#define SPF_CHAR          10  /* %c */
+#define SPF_POINTER       11  /* %p */
+#define SPF_TYPE          0x1F
+
+#define SPF_STAR          0x40  /* width is taken from an argument */
+#define SPF_ZEROES        0x80  /* keep leading zeroes */
+
+/** Macros for writing a plan as a constant array.  For example,
+ * "BALL %d" is { SPF_TEXT ("BALL "), SPF_FIELD (SPF_DECIMAL, 0),
+ * SPF_FINISH }. */
+#define SPF_TEXT(s) { SPF_COPY, sizeof (s) - 1, s }
+#define SPF_FIELD(type, width) { type, width, NULL }
+#define SPF_FINISH { SPF_END, 0, NULL }
+
+/** The number of ops kept for the last format; longer formats are
+ * compiled in pieces each time */
+#define SPRINTF_CACHE_OPS 8
+
+void sprintf_plan (const struct sprintf_op *plan, ...);
 void sprintf_far_string (const char **srcp);
 void sprintf_score (const U8 *score);
 void dbprintf1 (void);
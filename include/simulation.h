@@ -52,11 +52,13 @@ struct time_handler
 {
 	struct time_handler *next;
 	int periodicity;
+	unsigned int laps;
 	time_handler_t fn;
 	void *data;
 };
 
-void sim_time_register (int n_ticks, int periodic_p, time_handler_t fn, void *data);
+struct time_handler *sim_time_register (int n_ticks, int periodic_p, time_handler_t fn, void *data);
+void sim_time_cancel (struct time_handler *elem);
 void sim_time_step (void);
 unsigned long realtime_read (void);
 unsigned int sim_get_wall_clock (void);
@@ -111,13 +113,60 @@ void sim_switch_init (void);
 void exec_script (char *cmd);
 void exec_script_file (const char *filename);
 
+/** The types of configuration items */
+enum conf_type
+{
+	CONF_INT,
+	CONF_FLOAT,
+	CONF_STRING,
+};
+
+/** A handle to a configuration item, returned by conf_key() */
+typedef struct conf_item *conf_key_t;
+
+/** The callback type for changes to a configuration item */
+typedef void (*conf_watch_t) (conf_key_t key, void *data);
+
 void conf_add (const char *name, int *valp);
+void conf_add_float (const char *name, double *valp);
+void conf_add_string (const char *name, char **valp);
+conf_key_t conf_key (const char *name);
+const char *conf_key_name (conf_key_t key);
+enum conf_type conf_key_type (conf_key_t key);
+void conf_watch (conf_key_t key, conf_watch_t fn, void *data);
+int conf_get (conf_key_t key);
+double conf_get_float (conf_key_t key);
+const char *conf_get_string (conf_key_t key);
+void conf_set (conf_key_t key, int val);
+void conf_set_float (conf_key_t key, double val);
+void conf_set_string (conf_key_t key, const char *val);
 int conf_read (const char *name);
+bool conf_defined (const char *name);
 void conf_write (const char *name, int val);
+int conf_load (const char *filename);
+int conf_save (const char *filename);
 void conf_push (int val);
 void conf_pop (unsigned int count);
 int conf_read_stack (int offset);
 
+struct ball_node;
+extern int journal_events;
+void journal_suspend (void);
+void journal_resume (void);
+void journal_switch_toggle (int sw);
+void journal_switch_set (int sw, int on);
+void journal_node_move (struct ball_node *dst, struct ball_node *src, unsigned int delay);
+void journal_record (const char *filename);
+void journal_replay (const char *filename);
+void journal_stop (void);
+void journal_init (void);
+
+extern const char *audio_file;
+void audio_write (U16 cmd);
+void audio_open (const char *filename);
+void audio_close (void);
+void audio_init (void);
+
 void asciidmd_map_page (int mapping, int page);
 void asciidmd_refresh (void);
 void asciidmd_set_visible (int page);
@@ -144,6 +193,8 @@ void protected_memory_save (void);
 
 void mach_node_init (void);
 
+extern int sim_random_seed;
+
 void sim_init (void);
 __attribute__((noreturn)) void sim_exit (U8);
 
@@ -129,7 +129,7 @@ void sound_rtt (void);
 void sound_init (void);
 void sound_board_init (void);
 void sound_send (sound_code_t code);
-void sound_write (sound_code_t code);
+void sound_write (sound_code_t code, U8 prio);
 void sound_reset (void);
 void volume_set (U8);
 bool sound_version_render (void);
@@ -68,11 +68,11 @@ typedef struct
 extern const U8 mach_opto_mask[];
 extern const U8 mach_edge_switches[];
 
-/** The maximum number of switches that can be queued at
- * a time.  Queueing is necessary only for switches that
- * require a long (more than 4ms) debounce interval.
- * Keeping this as a power of 2 generates more efficient code. */
-#define MAX_QUEUED_SWITCHES 16
+/** The number of bits in the debounce timer of a queued switch.
+ * Queueing is necessary only for switches that require a long
+ * (more than 4ms) debounce interval, which can be at most
+ * 2^SWITCH_DEBOUNCE_BITS - 1 ticks. */
+#define SWITCH_DEBOUNCE_BITS 6
 
 #define SW_DEVICE_DECL(real_devno)	((real_devno) + 1)
 
@@ -235,6 +235,7 @@ void switch_init (void);
 void switch_rtt (void);
 void switch_periodic (void);
 void switch_sched_task (void);
+void switch_schedule (const U8 sw);
 void switch_idle (void);
 bool switch_poll (const switchnum_t sw);
 bool switch_is_opto (const switchnum_t sw);
@@ -242,6 +243,11 @@ bool switch_poll_logical (const switchnum_t sw);
 const switch_info_t *switch_lookup (const switchnum_t sw) __pure__;
 U8 switch_lookup_lamp (const switchnum_t sw) __pure__;
 void switch_queue_dump (void);
+#ifdef CONFIG_SWITCH_TRACE
+void switch_trace_scan (void);
+#else
+#define switch_trace_scan()
+#endif
 
 #if (MACHINE_PIC == 1)
 __init__ void pic_init (void);
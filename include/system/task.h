@@ -75,6 +75,17 @@ typedef void (*task_function_t) (void);
 /* Says that the task is in the blocked state */
 #define TASK_BLOCKED 0x10
 
+/* Says that the task has run at least once */
+#define TASK_STARTED 0x40
+
+
+/** Criticality classes, which say which tasks may be stopped to make
+room when the task table is full.  Lower classes are stopped first. */
+#define TASK_CRIT_COSMETIC 0   /* switch lamp pulses */
+#define TASK_CRIT_EFFECT 1     /* lamp effects */
+#define TASK_CRIT_PENDING 2    /* switch handlers that have not started */
+#define TASK_CRIT_REQUIRED 3   /* everything else; never stopped */
+
 
 /** Define the size of the saved process stack. */
 #define TASK_STACK_SIZE 40
@@ -108,7 +119,9 @@ typedef struct task_struct
 	 * task; or TASK_BLOCKED for a sleeping task. */
 	U8				state;
 
-	/** The index of the next block in the same chain.  Not used yet.
+	/** The index of the next block in the same chain.  A free block
+	 * is chained to the next free block; a task is chained to the next
+	 * task in the same group hash bucket.
 	 * A NULL is indicated by a -1, hence it is signed. */
 	S8          chain;
 
@@ -159,8 +172,9 @@ typedef struct task_struct
 	 * stopped automatically due to some external event. */
 	U8				duration;
 
-	/** Not currently used */
-	U8				reserved;
+	/** The index of this block in the task table, while it is used
+	 * by a task */
+	U8				index;
 
 	/** The task stack save area.  This is NOT used as the live stack
 	 * area; the live stack is copied here when the task blocks.
@@ -56,9 +56,12 @@ void adj_csum_failure (void)
 }
 
 
+bool adj_csum_migrate (U8 old_version, U8 old_length);
+
 const struct area_csum adj_csum_info = {
 	.type = FT_ADJUST,
-	.version = 1,
+	.version = 2,
+	.flags = CSUM_CRC16,
 	.area = (U8 *)&system_config,
 	.length = sizeof (system_config) + sizeof (price_config)
 		+ sizeof (hstd_config) + sizeof (printer_config)
@@ -66,9 +69,18 @@ const struct area_csum adj_csum_info = {
 		+ sizeof (feature_config)
 #endif
 	, .reset = adj_csum_failure,
+	.migrate = adj_csum_migrate,
 };
 
 
+/* Version 1 of the adjustments had the same layout, but used a plain sum
+as its checksum; the values can be kept as they are. */
+bool adj_csum_migrate (U8 old_version, U8 old_length)
+{
+	return old_version == 1 && old_length == adj_csum_info.length;
+}
+
+
 /** Called when an adjustment has been changed.  The checksum area
  * needs to be recalculated, and modules may want to know about the
  * change. */
@@ -35,7 +35,7 @@ __nvram__ feature_audits_t feature_audits;
 
 const struct area_csum audit_csum_info = {
 	.type = FT_AUDIT,
-	.version = 1,
+	.version = 3,
 	.area = (U8 *)&system_audits,
 	.length = sizeof (system_audits) + sizeof (feature_audits),
 	.reset = audit_reset,
@@ -52,16 +52,24 @@ void audit_reset (void)
 }
 
 
+/** Assign an audit value directly.  Only the change to the one audit
+is applied to the checksum, so this does not depend on how many audits
+there are. */
+void audit_assign (audit_t *aud, audit_t val)
+{
+	audit_t old = *aud;
+	pinio_nvram_unlock ();
+	(*aud) = val;
+	csum_area_update_word (&audit_csum_info, old, val);
+	pinio_nvram_lock ();
+}
+
+
 /** Increment an audit by 1 */
 void audit_increment (audit_t *aud)
 {
 	if (*aud < 0xFFFF)
-	{
-		pinio_nvram_unlock ();
-		(*aud)++;
-		csum_area_update (&audit_csum_info);
-		pinio_nvram_lock ();
-	}
+		audit_assign (aud, *aud + 1);
 }
 
 
@@ -69,22 +77,7 @@ void audit_increment (audit_t *aud)
 void audit_add (audit_t *aud, U8 val)
 {
 	if (*aud < 0xFFFF - (val - 1))
-	{
-		pinio_nvram_unlock ();
-		(*aud) += val;
-		csum_area_update (&audit_csum_info);
-		pinio_nvram_lock ();
-	}
-}
-
-
-/** Assign an audit value directly */
-void audit_assign (audit_t *aud, audit_t val)
-{
-	pinio_nvram_unlock ();
-	(*aud) = val;
-	csum_area_update (&audit_csum_info);
-	pinio_nvram_lock ();
+		audit_assign (aud, *aud + val);
 }
 
 
@@ -34,8 +34,16 @@
 #include <freewpc.h>
 
 
-U8 *
-csum_get_var (const struct area_csum *csi)
+/** The CRC-16 (CCITT, polynomial 0x1021) of each 4-bit value, used to
+ * compute the check of areas with CSUM_CRC16 a nibble at a time. */
+static const U16 crc16_table[16] = {
+	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+	0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+};
+
+
+static struct file_info *
+csum_get_file (const struct area_csum *csi)
 {
 	if (csi->type == 0 || csi->csum)
 	{
@@ -44,9 +52,52 @@ csum_get_var (const struct area_csum *csi)
 
 	struct file_info *fi = file_find (csi->type);
 	if (!fi)
-		dbprintf ("warning: csum_get_var could not find fi\n");
-	U8 *res = &fi->csum;
-	return res;
+		dbprintf ("warning: csum_get_file could not find fi\n");
+	return fi;
+}
+
+
+/**
+ * Compute the check value of 'len' bytes at 'area'.  Normally this is the
+ * 8-bit sum of the bytes; with CSUM_CRC16 in 'flags', it is a CRC-16.
+ */
+static U16
+csum_compute (U8 *area, size_t len, U8 flags)
+{
+	U8 *ptr;
+
+	if (flags & CSUM_CRC16)
+	{
+		U16 crc = 0xFFFF;
+		for (ptr = area; ptr < area + len; ptr++)
+		{
+			crc = (crc << 4) ^ crc16_table[(crc >> 12) ^ (*ptr >> 4)];
+			crc = (crc << 4) ^ crc16_table[(crc >> 12) ^ (*ptr & 0x0F)];
+		}
+		return crc;
+	}
+	else
+	{
+		U8 csum = 0;
+		for (ptr = area; ptr < area + len; ptr++)
+			csum += *ptr;
+		return csum;
+	}
+}
+
+
+/**
+ * Returns TRUE if the data described by a file table entry still matches
+ * its stored checksum.  This uses the address, length, and checksum type
+ * saved in the table, so it can check data from a previous version of
+ * the software.
+ */
+bool
+csum_file_valid (const struct file_info *fi)
+{
+	U16 csum = csum_compute (fi->data, fi->len, fi->attr);
+	return (csum & 0xFF) == fi->csum
+		&& (!(fi->attr & CSUM_CRC16) || (csum >> 8) == fi->csum_hi);
 }
 
 
@@ -58,18 +109,48 @@ csum_get_var (const struct area_csum *csi)
 void
 csum_area_update (const struct area_csum *csi)
 {
-	U8 csum;
-	U8 *ptr;
-	U8 *csum_var_p;
+	U16 csum;
+	struct file_info *fi;
 
 	/* Compute the current checksum of the area */
-	csum = 0;
-	for (ptr = csi->area; ptr < csi->area + csi->length; ptr++)
-		csum += *ptr;
+	csum = csum_compute (csi->area, csi->length, csi->flags);
 
 	/* Store this as the new checksum */
-	csum_var_p = csum_get_var (csi);
-	*csum_var_p = csum;
+	fi = csum_get_file (csi);
+	fi->csum = csum & 0xFF;
+	fi->csum_hi = csum >> 8;
+}
+
+
+/**
+ * Updates the checksum of a region after one byte in it changed from
+ * 'old_val' to 'new_val'.  For a summed region, this only adjusts the stored
+ * sum by the difference, without reading the rest of the region.  It
+ * assumes the region is UNLOCKED, like csum_area_update.
+ */
+void
+csum_area_update_byte (const struct area_csum *csi, U8 old_val, U8 new_val)
+{
+	if (csi->flags & CSUM_CRC16)
+		csum_area_update (csi);
+	else
+		csum_get_file (csi)->csum += new_val - old_val;
+}
+
+
+/**
+ * Updates the checksum of a region after a 16-bit value in it changed
+ * from 'old_val' to 'new_val'.  This is the same as two calls to
+ * csum_area_update_byte, one for each half.
+ */
+void
+csum_area_update_word (const struct area_csum *csi, U16 old_val, U16 new_val)
+{
+	if (csi->flags & CSUM_CRC16)
+		csum_area_update (csi);
+	else
+		csum_get_file (csi)->csum +=
+			(U8)(new_val >> 8) + (U8)new_val - (U8)(old_val >> 8) - (U8)old_val;
 }
 
 
@@ -96,18 +177,15 @@ csum_area_reset (const struct area_csum *csi)
 void
 csum_area_check (const struct area_csum *csi)
 {
-	U8 csum;
-	U8 *csum_var_p;
-	U8 *ptr;
+	U16 csum;
+	struct file_info *fi;
 
 	/* Compute the current checksum of the area */
-	csum = 0;
-	for (ptr = csi->area; ptr < csi->area + csi->length; ptr++)
-		csum += *ptr;
+	csum = csum_compute (csi->area, csi->length, csi->flags);
 
 	/* Compare against the stored checksum */
-	csum_var_p = csum_get_var (csi);
-	if (csum != *csum_var_p)
+	fi = csum_get_file (csi);
+	if ((csum & 0xFF) != fi->csum
+		|| ((csi->flags & CSUM_CRC16) && (csum >> 8) != fi->csum_hi))
 		csum_area_reset (csi);
 }
-
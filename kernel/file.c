@@ -35,47 +35,89 @@ __dirtab__ struct file_info file_info[MAX_FILE_INFO];
 
 
 /**
- * Return a pointer to the file info for a particular file type.
+ * An index from file type to its entry in the file table, so that lookups
+ * need not scan the table.  Each value is the entry number plus one, or
+ * zero if there is no entry for that type.  This is kept in ordinary RAM
+ * and rebuilt from the table at initialization.
  */
-struct file_info *file_find (enum file_type type)
+U8 file_index[NUM_FILE_TYPES];
+
+
+/**
+ * Return TRUE if a file table entry appears corrupted.
+ */
+static bool file_entry_corrupt (const struct file_info *fi)
+{
+	return fi->type != FT_NONE &&
+		(fi->type >= 0x40 ||
+#ifdef __m6809__
+		fi->data >= (void *)file_info ||
+#endif
+		fi->len > 0x200);
+}
+
+
+/**
+ * Rebuild the file index from the file table.  Entries that appear
+ * corrupted, or that repeat a type already seen, are freed.
+ */
+static void file_index_rebuild (void)
 {
 	U8 i;
 	struct file_info *fi;
+
+	memset (file_index, 0, sizeof (file_index));
+	pinio_nvram_unlock ();
 	for (i=0, fi = file_info; i < MAX_FILE_INFO; i++, fi++)
 	{
-		/* If the entry appears corrupted, ignore its contents hereafter. */
-		if (fi->type != FT_NONE &&
-				(fi->type >= 0x40 ||
-#ifdef __m6809__
-				fi->data >= (void *)file_info ||
-#endif
-				fi->len > 0x200))
-		{
-			pinio_nvram_unlock ();
+		if (file_entry_corrupt (fi))
 			fi->type = FT_NONE;
-			pinio_nvram_lock ();
+		else if (fi->type != FT_NONE && fi->type < NUM_FILE_TYPES)
+		{
+			if (file_index[fi->type])
+				fi->type = FT_NONE;
+			else
+				file_index[fi->type] = i + 1;
 		}
-
-		if (fi->type == type)
-			return fi;
 	}
-	return NULL;
+	pinio_nvram_lock ();
+}
+
+
+/**
+ * Return a pointer to the file info for a particular file type.
+ */
+struct file_info *file_find (enum file_type type)
+{
+	if (type == FT_NONE || type >= NUM_FILE_TYPES || !file_index[type])
+		return NULL;
+	return &file_info[file_index[type] - 1];
 }
 
 
 /* Create a new entry in the filesystem table. */
 struct file_info *file_create (enum file_type type)
 {
-	/* Find a free slot.  Ensure that the file does not already exist.
-	   Initialize it after creation. */
-	struct file_info *fi = file_find (FT_NONE);
-	if (!fi)
+	/* Find a free slot.  The caller ensures that the file does not
+	already exist.  Initialize it after creation. */
+	U8 i;
+	struct file_info *fi;
+
+	for (i=0, fi = file_info; i < MAX_FILE_INFO; i++, fi++)
+		if (fi->type == FT_NONE)
+			break;
+	if (i == MAX_FILE_INFO)
+	{
 		dbprintf ("warning: could not file_create!\n");
+		return NULL;
+	}
+
 	pinio_nvram_unlock ();
 	fi->type = type;
 	fi->attr = 0;
 	fi->version = 0;
 	pinio_nvram_lock ();
+	file_index[type] = i + 1;
 	return fi;
 }
 
@@ -85,6 +127,8 @@ struct file_info *file_create (enum file_type type)
  */
 void file_init (void)
 {
+	file_index_rebuild ();
+
 	/* Give each module a chance to declare its nvram structures.  (This
 	replaced the 'csum_area_check_all' function in earlier versions of the
 	software. */
@@ -118,6 +162,7 @@ void file_register (const struct area_csum *csi)
 {
 	struct file_info *fi;
 	bool need_reset = FALSE;
+	bool migrated = FALSE;
 
 	/* If type is FT_NONE, which is reserved, it probably means that csi was not
 	updated to include a value for the type field, so it defaults to zero.  This
@@ -137,6 +182,8 @@ void file_register (const struct area_csum *csi)
 	else
 	{
 		fi = file_create (csi->type);
+		if (!fi)
+			return;
 		dbprintf ("file type %d: new entry\n", csi->type);
 	}
 
@@ -145,11 +192,25 @@ void file_register (const struct area_csum *csi)
 
 	if (fi->version != csi->version)
 	{
-		/* If the version has changed, force reset.  Previous data will not be considered
-		no matter what.  Developers bump the version when they change the structure in
-		incompatible ways that absolutely require that previous data is discarded. */
+		/* If the version has changed, the old data can only be kept if the
+		module knows how to convert it.  That is only tried if the data is still
+		at the same address and its old checksum is good.  Otherwise, force reset.
+		Developers bump the version when they change the structure in
+		incompatible ways. */
 		dbprintf ("new version %d\n", csi->version);
 		need_reset = TRUE;
+		if (csi->migrate && fi->version < csi->version
+			&& fi->data == csi->area && csum_file_valid (fi))
+		{
+			pinio_nvram_unlock ();
+			migrated = csi->migrate (fi->version, fi->len);
+			pinio_nvram_lock ();
+			if (migrated)
+			{
+				dbprintf ("migrated from version %d\n", fi->version);
+				need_reset = FALSE;
+			}
+		}
 	}
 	else if (fi->data != csi->area)
 	{
@@ -174,11 +235,17 @@ void file_register (const struct area_csum *csi)
 	fi->version = csi->version;
 	fi->data = csi->area;
 	fi->len = csi->length;
+	fi->attr = csi->flags;
 	pinio_nvram_lock ();
 
 	if (need_reset)
 		csum_area_reset (csi);
+	else if (migrated)
+	{
+		pinio_nvram_unlock ();
+		csum_area_update (csi);
+		pinio_nvram_lock ();
+	}
 	else
 		csum_area_check (csi);
 }
-
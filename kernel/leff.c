@@ -413,6 +413,21 @@ void leff_stop (leffnum_t id)
 }
 
 
+/**
+ * Stop the lamp effect that is running under the given GID.  This is
+ * used to free tasks when the task table is full.
+ */
+void leff_stop_gid (task_gid_t gid)
+{
+	leffnum_t id = leff_running_list[gid - GID_LEFF_BASE];
+
+	if (id == LEFF_NULL)
+		task_kill_gid (gid);
+	else
+		leff_stop (id);
+}
+
+
 const leff_t *leff_get_current (void)
 {
 	task_gid_t gid;
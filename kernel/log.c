@@ -24,17 +24,22 @@
 __permanent__ U16 log_callset;
 __permanent__ U16 prev_log_callset;
 
-#ifdef DEBUG_LOG
+#ifdef CONFIG_LOG
+
+/** The number of events that have been logged.  The next one is written
+ * to slot (log_seq % MAX_LOG_EVENTS), overwriting the oldest. */
+U16 log_seq;
 
-/** The offset in the buffer of the next event to be read */
-U8 log_head;
+/** The system time when the last event was logged */
+U16 log_last_time;
 
-/** The offset in the buffer of the next slot for an event to be written */
-U8 log_tail;
+/** A bit for each module whose events are logged; see log_event */
+U16 log_module_mask;
 
 /** An array of log entries */
 struct log_event log_entry[MAX_LOG_EVENTS];
 
+#ifdef DEBUGGER
 char *log_module_names[] = {
 	[MOD_DEFF] = "Deff",
 	[MOD_LAMP] = "Lamp",
@@ -88,35 +93,53 @@ char *log_get_format (U16 module_event)
 
 	return "?";
 }
-#endif /* DEBUG_LOG */
+#endif /* DEBUGGER */
 
 
-/** Add an entry to the event log. */
-#ifdef CONFIG_LOG
-void log_event1 (U16 module_event, U8 arg)
+/** Return the timestamp for a new event: the time since the last one,
+ * in the form described in struct log_event. */
+static U8 log_timestamp (void)
 {
-	struct log_event *ev;
+	U16 now = get_sys_time ();
+	U16 delta;
+
+#ifdef CONFIG_NATIVE
+	delta = now - __sync_lock_test_and_set (&log_last_time, now);
+#else
+	delta = now - log_last_time;
+	log_last_time = now;
+#endif
+
+	if (delta < LOG_TS_COARSE)
+		return delta;
+	delta >>= LOG_TS_COARSE_SHIFT;
+	if (delta < 0x7F)
+		return LOG_TS_COARSE | delta;
+	return 0xFF;
+}
 
-	/* TODO : If logging has been disabled for this type of event,
-	 * stop now. */
 
-	ev = &log_entry[log_tail];
+/** Add an entry to the event log.  This is only called through log_event,
+ * which has already checked that the event is wanted. */
+void log_event1 (U16 module_event, U8 arg)
+{
+	struct log_event *ev;
 
-	/* The timestamp is stored as the number of ticks since
-	the last event. */
+	/* Claim the next slot.  In native mode, events may be logged from
+	 * more than one thread at once, so this is done atomically; the
+	 * rest of the entry belongs to this caller alone.  When the log
+	 * reaches the end, it always wraps around, overwriting previous
+	 * entries. */
+#ifdef CONFIG_NATIVE
+	ev = &log_entry[__sync_fetch_and_add (&log_seq, 1) % MAX_LOG_EVENTS];
+#else
+	ev = &log_entry[log_seq++ % MAX_LOG_EVENTS];
+#endif
 
 	/* Save the event data. */
-	ev->timestamp = 0;
-	ev->module_event = module_event;
+	ev->timestamp = log_timestamp ();
 	ev->arg = arg;
-
-	/* Advance the log forward.  When it reaches the end, we always
-	 * wrap around, overwriting previous entries. */
-	log_tail++;
-	if (log_tail >= MAX_LOG_EVENTS)
-	{
-		log_tail = 0;
-	}
+	ev->module_event = module_event;
 
 	/* TODO : See if a breakpoint has been set on the module_event.  This halts
 	all user task scheduling and enters the builtin debugger until
@@ -130,14 +153,186 @@ void log_event1 (U16 module_event, U8 arg)
 		log_get_format (module_event), arg);
 #endif
 }
+
+
+/** Write the event log, oldest first, in the binary form described
+ * by LOG_EXPORT_MAGIC.  Each byte is passed to 'put'. */
+void log_export (void (*put) (U8))
+{
+	U8 i;
+	const char *magic = LOG_EXPORT_MAGIC;
+	const struct log_event *ev;
+
+	while (*magic)
+		put (*magic++);
+
+	for (i = 0; i < MAX_LOG_EVENTS; i++)
+	{
+		ev = &log_entry[(log_seq + i) % MAX_LOG_EVENTS];
+		if (ev->module_event == LOG_EMPTY)
+			continue;
+		put (ev->timestamp);
+		put (module_part (ev->module_event));
+		put (event_part (ev->module_event));
+		put (ev->arg);
+	}
+}
+
+
+/** Print the event log, oldest first. */
+void log_dump (void)
+{
+#ifdef DEBUGGER
+	U8 i;
+	const struct log_event *ev;
+
+	dbprintf ("Event log, %ld events\n", log_seq);
+	dbprintf ("(16ms ticks since previous)\n");
+	for (i = 0; i < MAX_LOG_EVENTS; i++)
+	{
+		ev = &log_entry[(log_seq + i) % MAX_LOG_EVENTS];
+		if (ev->module_event == LOG_EMPTY)
+			continue;
+		dbprintf ("+%ld %s %s %02X\n", log_timestamp_ticks (ev->timestamp),
+			log_module_names[module_part (ev->module_event)],
+			log_get_format (ev->module_event), ev->arg);
+		task_runs_long ();
+	}
+#endif
+}
+
+
+#ifdef CONFIG_NATIVE
+static FILE *log_write_file;
+
+static void log_write_byte (U8 c)
+{
+	fputc (c, log_write_file);
+}
+
+/** Export the event log to a file. */
+void log_write (const char *filename)
+{
+	log_write_file = fopen (filename, "wb");
+	if (!log_write_file)
+		return;
+	log_export (log_write_byte);
+	fclose (log_write_file);
+}
+#endif /* CONFIG_NATIVE */
+
 #endif /* CONFIG_LOG */
 
 
+#ifdef CONFIG_SWITCH_TRACE
+/** The most recent switch traces.  Like the event log, this wraps
+ * around and overwrites the oldest. */
+struct switch_trace switch_trace_entry[MAX_SWITCH_TRACES];
+
+/** The offset of the next slot to be written */
+U8 switch_trace_tail;
+
+/** The number of valid entries */
+U8 switch_trace_count;
+
+/** Scratch space for sorting the latencies of one switch */
+static U8 switch_trace_sorted[MAX_SWITCH_TRACES];
+
+
+/** Save the trace of a switch event whose handler has returned. */
+void switch_trace_log (const struct switch_trace *trace)
+{
+	if (trace->sw == SW_TRACE_NONE)
+		return;
+	switch_trace_entry[switch_trace_tail] = *trace;
+	if (++switch_trace_tail >= MAX_SWITCH_TRACES)
+		switch_trace_tail = 0;
+	if (switch_trace_count < MAX_SWITCH_TRACES)
+		switch_trace_count++;
+}
+
+
+/** Sort the given stage of all traces of a switch, and return how
+ * many there were. */
+static U8 switch_trace_sort (U8 sw, U8 stage)
+{
+	U8 i, j, n, val;
+	const struct switch_trace *trace;
+
+	for (i = 0, n = 0; i < switch_trace_count; i++)
+	{
+		trace = &switch_trace_entry[i];
+		if (trace->sw != sw)
+			continue;
+		val = trace->at[stage];
+		for (j = n++; j > 0 && switch_trace_sorted[j-1] > val; j--)
+			switch_trace_sorted[j] = switch_trace_sorted[j-1];
+		switch_trace_sorted[j] = val;
+	}
+	return n;
+}
+
+
+/** Print the median, 90th percentile and worst time of a stage, in
+ * milliseconds, from the sorted latencies. */
+static void switch_trace_print_stage (const char *name, U8 n)
+{
+	dbprintf (" %s %ld/%ld/%ld", name,
+		(U16)switch_trace_sorted[(n - 1) / 2] * 2,
+		(U16)switch_trace_sorted[(U16)(n - 1) * 9 / 10] * 2,
+		(U16)switch_trace_sorted[n - 1] * 2);
+}
+
+
+/** Print the latencies of each switch that has been traced.  For each
+ * stage, the time from the first raw reading is given as the median,
+ * 90th percentile and worst case, in milliseconds.  A switch whose
+ * handlers start late points to other tasks that are not giving up
+ * the CPU; one whose handlers end late has a slow handler itself. */
+void switch_trace_dump (void)
+{
+	U8 sw, n, stage;
+	static const char *stage_names[] = {
+		[SW_TRACE_STABLE] = "stable",
+		[SW_TRACE_DEBOUNCED] = "debounced",
+		[SW_TRACE_START] = "start",
+		[SW_TRACE_END] = "end",
+	};
+
+	dbprintf ("Switch latency, %d events\n", switch_trace_count);
+	dbprintf ("(ms after raw; 50%%/90%%/max)\n");
+	for (sw = 0; sw < NUM_SWITCHES; sw++)
+	{
+		for (stage = 0; stage < SW_TRACE_STAGES; stage++)
+		{
+			n = switch_trace_sort (sw, stage);
+			if (n == 0)
+				break;
+			if (stage == 0)
+				dbprintf ("SW%d: %d", sw, n);
+			switch_trace_print_stage (stage_names[stage], n);
+		}
+		if (n != 0)
+			dbprintf ("\n");
+		task_runs_long ();
+	}
+}
+#endif /* CONFIG_SWITCH_TRACE */
+
+
 /** Initialize the event log. */
 void log_init (void)
 {
 #ifdef CONFIG_LOG
-	log_head = log_tail = 0;
+	U8 i;
+	for (i = 0; i < MAX_LOG_EVENTS; i++)
+		log_entry[i].module_event = LOG_EMPTY;
+	log_seq = 0;
+	log_last_time = get_sys_time ();
+	log_module_mask = LOG_DEFAULT_MODULES;
+#endif
+#ifdef CONFIG_SWITCH_TRACE
+	switch_trace_tail = switch_trace_count = 0;
 #endif
 
 	/* Save the last event logged from the previous run. */
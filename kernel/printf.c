@@ -18,7 +18,9 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#ifndef STANDALONE
 #include <freewpc.h>
+#endif
 
 /* When building with -mint16, 8-bit values are converted to 16-bits
 before they are passed as arguments.  */
@@ -52,6 +54,12 @@ before they are passed as arguments.  */
  *
  * This function is used even when running a native build.  The system's
  * 'sprintf' is never used.
+ *
+ * The format is first compiled into a list of struct sprintf_op, which is
+ * then run to produce the output.  The list for the last format is kept,
+ * keyed by its address and the ROM page, so that a format printed again
+ * and again, such as on a score screen, is only parsed once.  Constant
+ * lists can also be written directly and run with sprintf_plan.
  */
 
 
@@ -77,6 +85,18 @@ U8 commas_written;
 
 char separator_char;
 
+/** The arguments being printed */
+static va_list sprintf_va;
+
+/** The format whose compiled form is in sprintf_cache_plan, or NULL */
+const char *sprintf_cache_format;
+
+/** The ROM page that was mapped when sprintf_cache_format was compiled */
+U8 sprintf_cache_bank;
+
+/** The compiled form of the last format printed */
+struct sprintf_op sprintf_cache_plan[SPRINTF_CACHE_OPS];
+
 
 /** Convert a hex digit to its character representation */
 char digit2char (U8 digit)
@@ -182,268 +202,408 @@ char *do_sprintf_hex (char *buf, U16 w)
 }
 
 
-/** Generated formatted data based on the format string 'format'
- * into the buffer 'sprintf_buffer'.  Note that unlike the
- * real sprintf, this function doesn't return a value. */
-void sprintf (const char *format, ...)
+/** Remove the leading zeroes from the number just written between
+ * 'buf' and 'endbuf', unless they are wanted, and return the end of
+ * the result. */
+static char *sprintf_fixup_number (char *buf, char *endbuf)
 {
-	static va_list va;
-	static char *buf;
-	static char *endbuf;
-
-	buf = sprintf_buffer;
+	leading_zero_count = 0;
+	while (((buf[leading_zero_count] == '0') ||
+		(buf[leading_zero_count] == separator_char)) &&
+		(buf + leading_zero_count < endbuf))
+	{
+		leading_zero_count++;
+	}
 
-	va_start (va, format);
-	while (*format)
+	if (sprintf_leading_zeroes)
 	{
-		if (*format == '%')
+		/* OK to display leading zeroes */
+		buf = endbuf;
+	}
+	else
+	{
+		number_length = endbuf - buf;
+
+		/* Not OK to display leading zeroes */
+		/* memmove (buf,
+		 * 	buf+leading_zero_count,
+		 * 	number_length-leading_zero_count) */
+		if (number_length == leading_zero_count)
+		{
+			number_length = min_width;
+			buf[min_width-1] = '0';
+			buf += min_width;
+		}
+		else
 		{
-			if (format[1] == '%')
+			char *buf2 = buf;
+			number_length -= leading_zero_count;
+
+			while (number_length > 0)
 			{
-				format++;
-				goto output_char;
+				buf2[0] = buf2[leading_zero_count];
+				buf2++;
+				number_length--;
 			}
 
-			sprintf_width = 0;
-			sprintf_leading_zeroes = FALSE;
-			min_width = 1;
-			comma_positions = 0;
-			commas_written = 0;
+			buf = endbuf - leading_zero_count;
+		}
+	}
+	return buf;
+}
 
-do_format_chars:
-			format++;
-			switch (*format)
-			{
-				/* '%E' is a nonstandard form that means to preserve
-				the previous buffer and move to the end of it for
-				writing additional characters.  It only makes sense to
-				put this at the beginning of a format string. */
-				case 'E':
-					while (*buf != '\0')
-						buf++;
-					break;
 
-				/* Handle format char '*' to dynamically set
-				the width from a parameter */
-				case '*':
-					sprintf_width = va_arg (va, PROMOTED_U8);
-					goto do_format_chars;
+/** Compile the format string 'format' into the list 'op', which has room
+ * for 'max_ops' entries including the final SPF_END.  Returns the part of
+ * the format that did not fit, which is the empty string if all of it did. */
+static const char *sprintf_compile (const char *format, struct sprintf_op *op,
+	U8 max_ops)
+{
+	U8 type;
+	U8 width;
 
-				case '0':
-					if (sprintf_width == 0)
-					{
-						sprintf_leading_zeroes = TRUE;
-						sprintf_width = 1;
-						goto do_format_chars;
-					}
-					/* FALLTHRU on purpose */
-
-				case '1': case '2': case '3':
-				case '4': case '5': case '6':
-				case '7': case '8': case '9':
-					sprintf_width = (sprintf_width * 10) +
-						*format - '0';
-					goto do_format_chars;
+	while (*format && --max_ops)
+	{
+		if (*format != '%' || format[1] == '%')
+		{
+			/* Literal text runs up to the next '%'.  For "%%", the text
+			starts at the second '%'. */
+			if (*format == '%')
+				format++;
+			op->type = SPF_COPY;
+			op->width = 0;
+			op->text = format;
+			do {
+				format++;
+				op->width++;
+			} while (*format && *format != '%' && op->width < 0xFF);
+			op++;
+			continue;
+		}
 
-				case 'd':
-				case 'i':
-				{
-					register U8 b = va_arg (va, PROMOTED_U8);
-					endbuf = do_sprintf_decimal (buf, b);
-fixup_number:
-					leading_zero_count = 0;
-					while (((buf[leading_zero_count] == '0') ||
-						(buf[leading_zero_count] == separator_char)) &&
-						(buf + leading_zero_count < endbuf))
-					{
-						leading_zero_count++;
-					}
-
-					if (sprintf_leading_zeroes)
-					{
-						/* OK to display leading zeroes */
-						buf = endbuf;
-					}
-					else
-					{
-						number_length = endbuf - buf;
-
-						/* Not OK to display leading zeroes */
-						/* memmove (buf,
-						 * 	buf+leading_zero_count,
-						 * 	number_length-leading_zero_count) */
-						if (number_length == leading_zero_count)
-						{
-							number_length = min_width;
-							buf[min_width-1] = '0';
-							buf += min_width;
-						}
-						else
-						{
-							char *buf2 = buf;
-							number_length -= leading_zero_count;
-
-							while (number_length > 0)
-							{
-								buf2[0] = buf2[leading_zero_count];
-								buf2++;
-								number_length--;
-							}
-
-							buf = endbuf - leading_zero_count;
-						}
-					}
-					break;
-				}
+		type = 0;
+		width = 0;
 
-				case 'x': case 'X':
+do_format_chars:
+		format++;
+		switch (*format)
+		{
+			/* '%E' is a nonstandard form that means to preserve
+			the previous buffer and move to the end of it for
+			writing additional characters.  It only makes sense to
+			put this at the beginning of a format string. */
+			case 'E':
+				type |= SPF_APPEND;
+				break;
+
+			/* Handle format char '*' to dynamically set
+			the width from a parameter */
+			case '*':
+				type |= SPF_STAR;
+				goto do_format_chars;
+
+			case '0':
+				if (width == 0)
 				{
-					register U8 b = va_arg (va, PROMOTED_U8);
-					endbuf = do_sprintf_hex_byte (buf, b);
-					goto fixup_number;
-					break;
+					type |= SPF_ZEROES;
+					width = 1;
+					goto do_format_chars;
 				}
+				/* FALLTHRU on purpose */
+
+			case '1': case '2': case '3':
+			case '4': case '5': case '6':
+			case '7': case '8': case '9':
+				width = (width * 10) + *format - '0';
+				goto do_format_chars;
+
+			case 'd': case 'i':
+				type |= SPF_DECIMAL;
+				break;
+
+			case 'x': case 'X':
+				type |= SPF_HEX;
+				break;
+
+			case 'w':
+				type |= SPF_HEX32;
+				break;
+
+			case 'l':
+				if (format[1] == 'x' || format[1] == 'X')
+					type |= SPF_LONG_HEX;
+				else if (format[1] == 'd')
+					type |= SPF_LONG_DECIMAL;
+				if (format[1])
+					format++;
+				break;
+
+			case 'b':
+				type |= SPF_BCD;
+				break;
+
+			case 's':
+				type |= SPF_STRING;
+				break;
+
+			case 'c':
+				type |= SPF_CHAR;
+				break;
+
+			case 'p':
+				type |= SPF_POINTER;
+				break;
+
+			case '\0':
+				/* A '%' at the very end prints nothing */
+				format--;
+				break;
+		}
+		format++;
 
-				case 'w':
-				{
-#ifdef CONFIG_NATIVE
-do_32bit_hex_integer:
+		/* An unknown conversion prints nothing */
+		if (type & SPF_TYPE)
+		{
+			op->type = type;
+			op->width = width;
+			op->text = NULL;
+			op++;
+		}
+		else
+			max_ops++;
+	}
+
+	op->type = SPF_END;
+	return format;
+}
+
+
+/** Print one field of a compiled format at 'buf', taking its value from
+ * 'sprintf_va', and return the end of the output. */
+static char *sprintf_field (const struct sprintf_op *op, char *buf)
+{
+	char *endbuf;
+
+	sprintf_width = (op->type & SPF_STAR) ? va_arg (sprintf_va, PROMOTED_U8) : op->width;
+	sprintf_leading_zeroes = (op->type & SPF_ZEROES) ? TRUE : FALSE;
+	min_width = 1;
+	comma_positions = 0;
+	commas_written = 0;
+
+	switch (op->type & SPF_TYPE)
+	{
+		case SPF_APPEND:
+			while (*buf != '\0')
+				buf++;
+			return buf;
+
+		case SPF_DECIMAL:
+		{
+			register U8 b = va_arg (sprintf_va, PROMOTED_U8);
+			endbuf = do_sprintf_decimal (buf, b);
+			break;
+		}
+
+		case SPF_HEX:
+		{
+			register U8 b = va_arg (sprintf_va, PROMOTED_U8);
+			endbuf = do_sprintf_hex_byte (buf, b);
+			break;
+		}
+
+		case SPF_POINTER:
+			sprintf_leading_zeroes = TRUE;
+#ifdef CONFIG_NATIVE /* handle 32-bit pointers */
+			sprintf_width = 8;
+			/* FALLTHRU */
+#else
+			sprintf_width = 4;
+			goto do_long_hex_integer;
 #endif
-					do {
-						S8 n;
-						U32 w32 = va_arg (va, U32);
-						U8 *wp32 = (U8 *)&w32;
+
+		case SPF_HEX32:
+		{
+			S8 n;
+			U32 w32 = va_arg (sprintf_va, U32);
+			U8 *wp32 = (U8 *)&w32;
 #ifdef CONFIG_LITTLE_ENDIAN
-						for (n = 3; n >= 0; n--)
+			for (n = 3; n >= 0; n--)
 #else /* CONFIG_BIG_ENDIAN */
-						for (n = 0; n < 4; n++)
+			for (n = 0; n < 4; n++)
 #endif
-							buf = do_sprintf_hex_byte (buf, wp32[n]);
-						endbuf = buf;
-					} while (0);
-					break;
-				}
+				buf = do_sprintf_hex_byte (buf, wp32[n]);
+			return buf;
+		}
 
-				case 'l':
-				{
-					++format;
-					switch (*format)
-					{
-						case 'x': case 'X':
-						{
+		case SPF_LONG_HEX:
 #ifndef CONFIG_NATIVE
 do_long_hex_integer:
 #endif
-							do {
-								register U8 b = va_arg (va, U8);
-								endbuf = do_sprintf_hex_byte (buf, b);
-								b = va_arg (va, U8);
-								endbuf = do_sprintf_hex_byte (endbuf, b);
-								goto fixup_number;
-							} while (0);
-							break;
-						}
-
-						case 'd':
-						{
-							do {
-								register U16 w = va_arg (va, U16);
-								endbuf = do_sprintf_long_decimal (buf, w);
-								goto fixup_number;
-							} while (0);
-							break;
-						}
-					}
-					break;
-				}
+		{
+			register U8 b = va_arg (sprintf_va, U8);
+			endbuf = do_sprintf_hex_byte (buf, b);
+			b = va_arg (sprintf_va, U8);
+			endbuf = do_sprintf_hex_byte (endbuf, b);
+			break;
+		}
 
-				case 'b':
-				{
-					/* TODO : this used to be a 'register' variable, but
-					 * with the most recent gcc, that causes incorrect
-					 * values to be displayed.  'static' works though... */
-					static bcd_t *bcd;
-					bcd = va_arg (va, bcd_t *);
-					endbuf = buf;
-
-					/* Initialize 'comma_positions' based on the length
-					of the number.  When the least significant bit is
-					set, it means that a comma should be printed AFTER
-					the next digit is output.  As digits are printed,
-					this variable is right-shifted. */
-					switch (sprintf_width)
-					{
-						default:
-							comma_positions = 0;
-							break;
-
-						case 8:
-							comma_positions = 0x2 | 0x10;
-							break;
-
-						case 10:
-							comma_positions = 0x1 | 0x8 | 0x40;
-							break;
-					}
-
-					do
-					{
-						endbuf = do_sprintf_hex_byte (endbuf, *bcd++);
-						sprintf_width -= 2;
-					} while (sprintf_width);
-					min_width = 2;
-					goto fixup_number;
+		case SPF_LONG_DECIMAL:
+		{
+			register U16 w = va_arg (sprintf_va, U16);
+			endbuf = do_sprintf_long_decimal (buf, w);
+			break;
+		}
+
+		case SPF_BCD:
+		{
+			/* TODO : this used to be a 'register' variable, but
+			 * with the most recent gcc, that causes incorrect
+			 * values to be displayed.  'static' works though... */
+			static bcd_t *bcd;
+			bcd = va_arg (sprintf_va, bcd_t *);
+			endbuf = buf;
+
+			/* Initialize 'comma_positions' based on the length
+			of the number.  When the least significant bit is
+			set, it means that a comma should be printed AFTER
+			the next digit is output.  As digits are printed,
+			this variable is right-shifted. */
+			switch (sprintf_width)
+			{
+				default:
+					comma_positions = 0;
 					break;
-				}
 
-				case 's':
-				{
-					register const char *s = va_arg (va, const char *);
-					register char *_buf = buf;
-					if (sprintf_width == 0)
-						while (*s)
-							*_buf++ = *s++;
-					else
-						do {
-							*_buf++ = *s++;
-						} while (--sprintf_width);
-
-					buf = _buf;
+				case 8:
+					comma_positions = 0x2 | 0x10;
 					break;
-				}
 
-				case 'c':
-				{
-					register const char c = va_arg (va, PROMOTED_U8);
-					*buf++ = c;
+				case 10:
+					comma_positions = 0x1 | 0x8 | 0x40;
 					break;
-				}
+			}
 
-				case 'p':
-				{
-					sprintf_leading_zeroes = TRUE;
-#ifdef CONFIG_NATIVE /* handle 32-bit pointers */
-					sprintf_width = 8;
-					goto do_32bit_hex_integer;
-#else
-					sprintf_width = 4;
-					goto do_long_hex_integer;
-#endif
-				}
+			do
+			{
+				endbuf = do_sprintf_hex_byte (endbuf, *bcd++);
+				sprintf_width -= 2;
+			} while (sprintf_width);
+			min_width = 2;
+			break;
+		}
+
+		case SPF_STRING:
+		{
+			register const char *s = va_arg (sprintf_va, const char *);
+			register char *_buf = buf;
+			if (sprintf_width == 0)
+				while (*s)
+					*_buf++ = *s++;
+			else
+				do {
+					*_buf++ = *s++;
+				} while (--sprintf_width);
+			return _buf;
+		}
+
+		case SPF_CHAR:
+		{
+			register const char c = va_arg (sprintf_va, PROMOTED_U8);
+			*buf++ = c;
+			return buf;
+		}
+
+		default:
+			return buf;
+	}
+
+	return sprintf_fixup_number (buf, endbuf);
+}
+
+
+/** Run a compiled format, writing at 'buf', and return the end of the
+ * output.  This stops early when the buffer is nearly full. */
+static char *sprintf_run (const struct sprintf_op *op, char *buf)
+{
+	const char *text;
+	U8 len;
+
+	for (; op->type != SPF_END; op++)
+	{
+		if (op->type == SPF_COPY)
+		{
+			text = op->text;
+			for (len = op->width; len; len--)
+			{
+				*buf++ = *text++;
+				if (buf > sprintf_buffer + PRINTF_BUFFER_SIZE - 2)
+					return buf;
 			}
 		}
 		else
 		{
-output_char:
-			*buf++ = *format;
+			buf = sprintf_field (op, buf);
+
+			/* Detect when close to buffer overflow here and break out */
+			if (buf > sprintf_buffer + PRINTF_BUFFER_SIZE - 2)
+				break;
 		}
-		format++;
+	}
+	return buf;
+}
 
-		/* Detect when close to buffer overflow here and break out */
-		if (buf > sprintf_buffer + PRINTF_BUFFER_SIZE - 2)
-			break;
+
+/** Generated formatted data based on the format string 'format'
+ * into the buffer 'sprintf_buffer'.  Note that unlike the
+ * real sprintf, this function doesn't return a value. */
+void sprintf (const char *format, ...)
+{
+	static char *buf;
+	const char *rest;
+	U8 bank = pinio_get_bank (PINIO_BANK_ROM);
+
+	buf = sprintf_buffer;
+	va_start (sprintf_va, format);
+
+	if (format != sprintf_cache_format || bank != sprintf_cache_bank)
+	{
+		/* Compile the format, and keep it if it all fits.  Otherwise,
+		run it one piece at a time. */
+		rest = sprintf_compile (format, sprintf_cache_plan, SPRINTF_CACHE_OPS);
+		if (*rest == '\0')
+		{
+			sprintf_cache_format = format;
+			sprintf_cache_bank = bank;
+		}
+		else
+		{
+			sprintf_cache_format = NULL;
+			do {
+				buf = sprintf_run (sprintf_cache_plan, buf);
+				if (buf > sprintf_buffer + PRINTF_BUFFER_SIZE - 2)
+					goto done;
+				rest = sprintf_compile (rest, sprintf_cache_plan, SPRINTF_CACHE_OPS);
+			} while (*rest);
+		}
 	}
-	va_end (va);
+	buf = sprintf_run (sprintf_cache_plan, buf);
+
+done:
+	va_end (sprintf_va);
+	*buf = '\0';
+}
+
+
+/** Like sprintf, but print a format that has already been compiled,
+ * such as a constant list written with the SPF_ macros. */
+void sprintf_plan (const struct sprintf_op *plan, ...)
+{
+	static char *buf;
+
+	buf = sprintf_buffer;
+	va_start (sprintf_va, plan);
+	buf = sprintf_run (plan, buf);
+	va_end (sprintf_va);
 	*buf = '\0';
 }
 
@@ -472,19 +632,21 @@ sprintf_far_string (const char **srcp)
 }
 
 
-/** Output a BCD-encoded score */
+/** Output a BCD-encoded score.  This is the same as "%8b", "%10b" or
+"%12b", precompiled since it is drawn so often. */
+#if (MACHINE_SCORE_DIGITS != 8) && (MACHINE_SCORE_DIGITS != 10) && (MACHINE_SCORE_DIGITS != 12)
+#error "invalid number of score digits"
+#endif
+
+static const struct sprintf_op sprintf_score_plan[] = {
+	SPF_FIELD (SPF_BCD, MACHINE_SCORE_DIGITS),
+	SPF_FINISH
+};
+
 void
 sprintf_score (const U8 *score)
 {
-#if (MACHINE_SCORE_DIGITS == 8)
-	sprintf ("%8b", score);
-#elif (MACHINE_SCORE_DIGITS == 10)
-	sprintf ("%10b", score);
-#elif (MACHINE_SCORE_DIGITS == 12)
-	sprintf ("%12b", score);
-#else
-#error "invalid number of score digits"
-#endif
+	sprintf_plan (sprintf_score_plan, score);
 }
 
 
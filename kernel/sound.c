@@ -37,6 +37,15 @@
  * The WPC sound board uses 8-bit commands for most things; one of the command
  * values acts as an escape, though, and causes the next 8-bit value to be
  * interpreted (differently) instead.
+ *
+ * Sound and music calls are not written to the byte queue directly.  They
+ * wait in a short command queue, which the realtime function expands into
+ * bytes once the previous command has gone out.  While a call is waiting,
+ * it can still be replaced: a newer music code replaces an older one, a
+ * sound call already waiting is not queued twice, and when the queue is
+ * full, the lowest priority effect gives way to a call of at least the
+ * same priority.  This keeps a burst of calls from delaying the important
+ * ones behind many that would be out of date by the time they were sent.
  */
 
 
@@ -52,6 +61,26 @@ __fastram__ struct {
 	U8 elems[SOUND_QUEUE_LEN];
 } sound_write_queue;
 
+/** The length of the command queue.  These are sound and music calls not
+ * yet expanded into the write queue. */
+#define SOUND_CMD_QUEUE_LEN 8
+
+/** The priority given to music calls.  There is at most one of these
+ * waiting, and it is never dropped. */
+#define SOUND_PRIO_MUSIC 0xFF
+
+struct sound_cmd
+{
+	sound_code_t code;
+	U8 prio;
+};
+
+/** The command queue.  The oldest command is always first. */
+__fastram__ struct {
+	U8 count;
+	struct sound_cmd elems[SOUND_CMD_QUEUE_LEN];
+} sound_cmd_queue;
+
 /** The sound read queue, which works just like the write queue but takes
 back data from the sound board. */
 __fastram__ struct {
@@ -116,7 +145,10 @@ bool sound_version_render (void)
 	}
 }
 
-/** Queues a byte for transmit to the sound board */
+/** Queues a byte for transmit to the sound board.  The realtime function
+ * also fills this queue when it expands a waiting call, so callers in task
+ * context must disable interrupts around the whole command, so that its
+ * bytes are not split or interleaved with another. */
 static __attribute__((noinline)) void sound_write_queue_insert (U8 val)
 {
 	queue_insert (&sound_write_queue.header, SOUND_QUEUE_LEN, val);
@@ -137,6 +169,101 @@ inline bool sound_write_queue_empty_p (void)
 }
 
 
+/** Queues a sound or music call.  This runs in task context, while the
+ * realtime function takes calls off the front of the queue, so the
+ * queue is only changed with interrupts disabled.  The audits are
+ * updated afterwards, as they write to protected memory. */
+static void sound_cmd_insert (sound_code_t code, U8 prio)
+{
+	struct sound_cmd *cmd;
+	struct sound_cmd *victim;
+	U8 count;
+	bool dropped = FALSE;
+
+	disable_irq ();
+	cmd = sound_cmd_queue.elems;
+	count = sound_cmd_queue.count;
+
+	/* Look for a waiting call that this one makes redundant, and
+	while there, the one to drop if the queue is full */
+	victim = NULL;
+	for (; cmd < sound_cmd_queue.elems + count; cmd++)
+	{
+		if (prio == SOUND_PRIO_MUSIC && cmd->prio == SOUND_PRIO_MUSIC)
+		{
+			cmd->code = code;
+			enable_irq ();
+			return;
+		}
+		else if (cmd->code == code && cmd->prio != SOUND_PRIO_MUSIC
+			&& prio != SOUND_PRIO_MUSIC)
+		{
+			if (prio > cmd->prio)
+				cmd->prio = prio;
+			enable_irq ();
+			return;
+		}
+		if (!victim || cmd->prio < victim->prio)
+			victim = cmd;
+	}
+
+	if (count == SOUND_CMD_QUEUE_LEN)
+	{
+		dropped = TRUE;
+		if (victim->prio > prio)
+		{
+			enable_irq ();
+			audit_increment (&system_audits.sound_drops);
+			return;
+		}
+		count--;
+		for (cmd = victim; cmd < sound_cmd_queue.elems + count; cmd++)
+			cmd[0] = cmd[1];
+	}
+
+	cmd = sound_cmd_queue.elems + count;
+	cmd->code = code;
+	cmd->prio = prio;
+	sound_cmd_queue.count = ++count;
+	enable_irq ();
+
+	if (dropped)
+		audit_increment (&system_audits.sound_drops);
+	else if (count > system_audits.sound_queue_max)
+		audit_assign (&system_audits.sound_queue_max, count);
+}
+
+
+/** Expands the oldest waiting call into the write queue.  This is
+ * called by the realtime function when the write queue is empty. */
+static void sound_cmd_expand (void)
+{
+	struct sound_cmd *cmd = sound_cmd_queue.elems;
+	U8 code_lo = cmd->code & 0xFF;
+	U8 code_hi = cmd->code >> 8;
+
+#if (MACHINE_DCS == 0)
+	if (code_hi == 0)
+	{
+		sound_write_queue_insert (code_lo);
+	}
+	else
+#endif
+	{
+#if (MACHINE_DCS == 1)
+		sound_write_queue_insert (code_hi);
+#else
+		sound_write_queue_insert (SND_START_EXTENDED);
+#endif
+		sound_write_queue_insert (code_lo);
+	}
+
+	sound_cmd_queue.count--;
+	for (; cmd < sound_cmd_queue.elems + sound_cmd_queue.count; cmd++)
+		cmd[0] = cmd[1];
+}
+
+
 void music_set (music_code_t code)
 {
 	/* Don't send the command again if the same music is already
@@ -155,10 +282,7 @@ void music_set (music_code_t code)
 			&& (system_config.game_music == ON))
 		|| (code == MUS_OFF))
 	{
-#if (MACHINE_DCS == 1)
-		sound_write_queue_insert (0);
-#endif
-		sound_write_queue_insert (current_music);
+		sound_cmd_insert (current_music, SOUND_PRIO_MUSIC);
 	}
 }
 
@@ -210,12 +334,14 @@ U8 sound_board_command (sound_cmd_t cmd, U8 retries)
 {
 #ifndef CONFIG_NATIVE
 	do {
+		disable_irq ();
 #if (MACHINE_DCS == 1)
 		sound_write_queue_insert (cmd >> 8);
 		sound_write_queue_insert (cmd & 0xFF);
 #else
 		sound_write_queue_insert (cmd);
 #endif
+		enable_irq ();
 		task_sleep (TIME_33MS);
 
 		if (queue_empty_p ((queue_t *)&sound_read_queue))
@@ -262,11 +388,16 @@ void sound_read_rtt (void)
 
 void sound_write_rtt (void)
 {
-	/* Write a pending byte to the sound board */
-	if (unlikely (!sound_write_queue_empty_p ()))
+	/* Start on the next call if the last one has gone out */
+	if (likely (sound_write_queue_empty_p ()))
 	{
-		pinio_write_sound (sound_write_queue_remove ());
+		if (likely (sound_cmd_queue.count == 0))
+			return;
+		sound_cmd_expand ();
 	}
+
+	/* Write a pending byte to the sound board */
+	pinio_write_sound (sound_write_queue_remove ());
 }
 
 
@@ -289,6 +420,7 @@ void sound_init (void)
 	/* Initialize the input/output queues to the sound board. */
 	queue_init (&sound_read_queue.header);
 	queue_init (&sound_write_queue.header);
+	sound_cmd_queue.count = 0;
 }
 
 
@@ -340,31 +472,12 @@ exit_func:
 
 
 /**
- * Write a 16-bit value to the sound board.
+ * Write a 16-bit value to the sound board.  PRIO decides which calls
+ * are dropped if too many are waiting.
  */
-__attribute__((noinline)) void sound_write (sound_code_t code)
+__attribute__((noinline)) void sound_write (sound_code_t code, U8 prio)
 {
-	U8 code_lo;
-	U8 code_hi;
-
-	code_lo = code & 0xFF;
-	code_hi = code >> 8;
-
-#if (MACHINE_DCS == 0)
-	if (code_hi == 0)
-	{
-		sound_write_queue_insert (code_lo);
-	}
-	else
-#endif
-	{
-#if (MACHINE_DCS == 1)
-		sound_write_queue_insert (code_hi);
-#else
-		sound_write_queue_insert (SND_START_EXTENDED);
-#endif
-		sound_write_queue_insert (code_lo);
-	}
+	sound_cmd_insert (code, prio);
 }
 
 
@@ -403,15 +516,18 @@ void volume_set (U8 vol)
 	{
 #if (MACHINE_DCS == 1)
 		U8 code = current_volume * 8;
+		disable_irq ();
 		sound_write_queue_insert (0x55);
 		sound_write_queue_insert (0xAA);
 		sound_write_queue_insert (code);
 		sound_write_queue_insert (~code);
 #else
+		disable_irq ();
 		sound_write_queue_insert (SND_SET_VOLUME_CMD);
 		sound_write_queue_insert (current_volume);
 		sound_write_queue_insert (~current_volume);
 #endif
+		enable_irq ();
 	}
 }
 
@@ -27,29 +27,6 @@
 #include <diag.h>
 #include <search.h>
 
-/*
- * A pending switch is one which has changed levels for 2
- * consecutive readings at interrupt time, but needs to
- * be debounced further.
- *
- * This struct tracks the switch number, its state, and the
- * debounce timer.
- *
- * There are a finite number of these objects.  When a change
- * is detected, we will either allocate a new slot or
- * re-use an existing slot for the same switch that did not
- * complete its previous debounce cycle.
- */
-typedef struct
-{
-	/* The switch number that is pending */
-	U8 id;
-
-	/* The amount of time left before the transition completes. */
-	S8 timer;
-} pending_switch_t;
-
-
 /** The raw input values of the switch.  These values are
  * updated every 2ms, and are only used as inputs into the
  * debounce procedure.  Higher layer software never looks at
@@ -78,21 +55,20 @@ __fastram__ switch_bits_t sw_unstable;
  * see what the current state of a switch is. */
 __fastram__ switch_bits_t sw_logical;
 
-/** Nonzero for each switch that is in the switch queue.
- * This is not strictly needed, but it provides a fast way to
- * see if a switch is already in the queue without having to
- * scan the entire array. */
+/** Nonzero for each switch that is in the switch queue, that is,
+ * one which has changed levels for 2 consecutive readings at
+ * interrupt time, but needs to be debounced further. */
 switch_bits_t sw_queued;
 
-/* An array of pending switches which have not fully debounced yet.
- * The array is kept compact, meaning that if there are N entries
- * used, they will always be in slots [0] to [N-1]. */
-pending_switch_t switch_queue[MAX_QUEUED_SWITCHES];
+/** Nonzero for each switch that needs to be queued for a longer
+ * debounce.  This is computed from the switch table at init time. */
+switch_bits_t sw_long_debounce;
 
-/* A pointer to the first free entry in the switch queue.
- * When this is equal to 'switch_queue', it means the entire
- * queue is empty. */
-__fastram__ pending_switch_t *switch_queue_top;
+/** The debounce timers of the queued switches, as vertical counters:
+ * bit N of a switch's timer is its bit in sw_debounce_timer[N].  This
+ * lets the timers of a whole column be counted down at once with a
+ * few byte operations, no matter how many switches are queued. */
+switch_bits_t sw_debounce_timer[SWITCH_DEBOUNCE_BITS];
 
 /** The last time that switch scanning occurred.  It is used
  * to determine by how much to decrement debounce timers. */
@@ -102,6 +78,61 @@ U16 switch_last_service_time;
  * Provided as a convenience for test mode. */
 U8 sw_last_scheduled;
 
+/** The number of switch events that can wait for the dispatcher */
+#define SWITCH_EVENT_QUEUE_LEN 16
+
+/** The ring of switch events waiting for the dispatcher.  Events are
+ * added at the tail and taken from the head. */
+struct switch_event {
+	U8 sw;
+	U8 time;
+#ifdef CONFIG_SWITCH_TRACE
+	struct switch_trace trace;
+#endif
+} switch_events[SWITCH_EVENT_QUEUE_LEN];
+U8 switch_event_head;
+U8 switch_event_tail;
+
+/** The dispatcher task that is taking events from the ring, if any */
+task_pid_t switch_dispatcher;
+
+/** True while the dispatcher is running a switch handler */
+bool switch_dispatch_in_handler;
+
+#ifdef DEBUGGER
+/** The longest time that each switch has waited in the ring, in
+ * 16ms ticks */
+U8 sw_dispatch_latency[NUM_SWITCHES];
+#endif
+
+#ifdef CONFIG_SWITCH_TRACE
+/** Counts the switch scans, every 2ms.  This is the clock for
+ * switch tracing. */
+U16 switch_trace_clock;
+
+/** Nonzero for each switch whose new reading is being traced, from
+ * the first scan that saw it until it is latched */
+switch_bits_t sw_trace_active;
+
+/** The stable bits as of the previous scan */
+switch_bits_t sw_trace_stable;
+
+/** The scan that first saw the new reading of each traced switch */
+U16 sw_trace_raw[NUM_SWITCHES];
+
+/** The scans until each traced switch became stable */
+U8 sw_trace_stable_at[NUM_SWITCHES];
+#endif
+
+/** The number of switch lamps that can pulse at once */
+#define MAX_SWITCH_LAMP_PULSES 4
+
+/** The switch lamps that are pulsing, and the 100ms steps left */
+struct switch_lamp_pulse {
+	U8 lamp;
+	U8 timer;
+} switch_lamp_pulses[MAX_SWITCH_LAMP_PULSES];
+
 /** Nonzero if a switch short was detected and switches need to be
  * ignored for some time.  The value indicates the number of
  * seconds to ignore switches. */
@@ -176,54 +207,150 @@ bool switch_poll_logical (const switchnum_t sw)
 }
 
 
-typedef struct
+#ifdef CONFIG_SWITCH_TRACE
+/** Return the number of scans since the given one, up to 255 */
+static U8 switch_trace_since (U16 raw)
+{
+	U16 scans = switch_trace_clock - raw;
+	return (scans > 0xFF) ? 0xFF : scans;
+}
+
+
+/** Note the switches that have a new raw reading, or became stable,
+ * during the last scan.  This is called by switch_rtt after reading
+ * all of the columns, so it needs to be quick when nothing changes. */
+void switch_trace_scan (void)
+{
+	U8 col, bits, sw;
+
+	switch_trace_clock++;
+	for (col = 0; col < SWITCH_BITS_SIZE; col++)
+	{
+		/* A switch that went back to its logical reading before it
+		was stable is no longer traced. */
+		sw_trace_active[col] &= sw_edge[col] | sw_stable[col];
+
+		/* A new reading starts a trace. */
+		bits = sw_edge[col] & ~sw_trace_active[col];
+		if (unlikely (bits))
+		{
+			sw_trace_active[col] |= bits;
+			for (sw = col * 8; bits; bits >>= 1, sw++)
+				if (bits & 1)
+					sw_trace_raw[sw] = switch_trace_clock;
+		}
+
+		/* See which traced switches have become stable. */
+		bits = sw_stable[col] & ~sw_trace_stable[col] & sw_trace_active[col];
+		sw_trace_stable[col] = sw_stable[col];
+		if (unlikely (bits))
+		{
+			for (sw = col * 8; bits; bits >>= 1, sw++)
+				if (bits & 1)
+					sw_trace_stable_at[sw] = switch_trace_since (sw_trace_raw[sw]);
+		}
+	}
+}
+
+
+/** Start the trace of a switch event that is being scheduled. */
+static void switch_trace_schedule (struct switch_trace *trace, const U8 sw)
 {
-	const switch_info_t *swinfo;
-	leff_data_t leffdata;
-} lamp_pulse_data_t;
+	/* Switches scheduled other than by the scan, for example by the
+	stress test, are not traced. */
+	if (!bitarray_test (sw_trace_active, sw))
+	{
+		trace->sw = SW_TRACE_NONE;
+		return;
+	}
+	trace->sw = sw;
+	trace->raw = sw_trace_raw[sw];
+	trace->at[SW_TRACE_STABLE] = sw_trace_stable_at[sw];
+	trace->at[SW_TRACE_DEBOUNCED] = switch_trace_since (trace->raw);
+}
+#endif /* CONFIG_SWITCH_TRACE */
 
 
-/** Task that performs a switch lamp pulse.
+/** Task that performs switch lamp pulses.
  * Some switches are inherently tied to a lamp.  When the switch
  * triggers, the lamp can be automatically flickered.  This is
  * implemented as a pseudo-lamp effect, so the true state of the
- * lamp is not disturbed. */
-void switch_lamp_pulse (void)
+ * lamp is not disturbed.  The lamp is changed at once; this one
+ * task changes back and frees all of the pulsing lamps, rather than
+ * one task for each. */
+void switch_lamp_pulse_task (void)
+{
+	struct switch_lamp_pulse *pulse;
+	bool active;
+
+	do {
+		task_sleep (TIME_100MS);
+		active = FALSE;
+		for (pulse = switch_lamp_pulses;
+			pulse < switch_lamp_pulses + MAX_SWITCH_LAMP_PULSES; pulse++)
+		{
+			if (pulse->lamp == 0)
+				continue;
+			if (--pulse->timer == 2)
+			{
+				/* Change it back */
+				leff_toggle (pulse->lamp);
+			}
+			else if (pulse->timer == 0)
+			{
+				/* Free the lamp */
+				leff_quick_free (pulse->lamp);
+				pulse->lamp = 0;
+				continue;
+			}
+			active = TRUE;
+		}
+	} while (active);
+	task_exit ();
+}
+
+
+/** Start a switch lamp pulse */
+static void switch_lamp_pulse (U8 lamp)
 {
-	lamp_pulse_data_t * const cdata = task_current_class_data (lamp_pulse_data_t);
+	struct switch_lamp_pulse *pulse;
 
-	/* If the lamp is already allocated by another lamp effect,
-	then don't bother trying to do the pulse. */
-	if (leff_quick_alloc (cdata->swinfo->lamp))
+	for (pulse = switch_lamp_pulses;
+		pulse < switch_lamp_pulses + MAX_SWITCH_LAMP_PULSES; pulse++)
 	{
-		/* Change the state of the lamp */
-		if (lamp_test (cdata->swinfo->lamp))
-			leff_off (cdata->swinfo->lamp);
-		else
-			leff_on (cdata->swinfo->lamp);
-		task_sleep (TIME_200MS);
-
-		/* Change it back */
-		leff_toggle (cdata->swinfo->lamp);
-		task_sleep (TIME_200MS);
-
-		/* Free the lamp */
-		leff_quick_free (cdata->swinfo->lamp);
+		if (pulse->lamp == 0)
+		{
+			/* If the lamp is already allocated by another lamp effect,
+			then don't bother trying to do the pulse. */
+			if (!leff_quick_alloc (lamp))
+				break;
+
+			/* Change the state of the lamp */
+			if (lamp_test (lamp))
+				leff_off (lamp);
+			else
+				leff_on (lamp);
+			pulse->lamp = lamp;
+			pulse->timer = 4;
+			break;
+		}
 	}
-	task_exit ();
+
+	/* Start the task even if no pulse was added, so that pulses
+	left behind by a task that was stopped are finished. */
+	task_create_gid1 (GID_SWITCH_LAMP_PULSE, switch_lamp_pulse_task);
 }
 
 
 /*
- * The entry point for processing a switch transition.  It performs
- * some of the common switch handling logic before calling all
- * event handlers.  Then it also performs some common post-processing.
- * This function runs in a separate task context for each switch that
- * needs to be processed.
+ * Process a switch transition.  It performs some of the common switch
+ * handling logic before calling all event handlers.  Then it also
+ * performs some common post-processing.  This runs in the switch
+ * dispatcher task, or in a task of its own when the dispatcher could
+ * not take it.
  */
-void switch_sched_task (void)
+static void switch_process (const U8 sw)
 {
-	const U8 sw = (U8)task_get_arg ();
 	const switch_info_t * const swinfo = switch_lookup (sw);
 
 	/* Ignore any switch that doesn't have a processing function.
@@ -253,13 +380,7 @@ void switch_sched_task (void)
 	/* If the switch has an associated lamp, then flicker the lamp when
 	 * the switch triggers. */
 	if ((swinfo->lamp != 0) && in_live_game)
-	{
-		task_pid_t tp = task_create_gid (GID_SWITCH_LAMP_PULSE,
-			switch_lamp_pulse);
-
-		lamp_pulse_data_t *cdata = task_init_class_data (tp, lamp_pulse_data_t);
-		cdata->swinfo = swinfo;
-	}
+		switch_lamp_pulse (swinfo->lamp);
 
 	/* If we're in a live game and the switch declares a standard
 	 * sound, then make it happen. */
@@ -323,93 +444,209 @@ cleanup:
 	 * regardless of any of the above conditions checked. */
 	if (SW_HAS_DEVICE (swinfo))
 		device_sw_handler (SW_GET_DEVICE (swinfo));
+}
+
+
+/** A task that processes a single switch transition, given as its
+ * argument.  This is used when the switch could not be queued for
+ * the dispatcher. */
+void switch_sched_task (void)
+{
+	switch_process ((U8)task_get_arg ());
+	task_exit ();
+}
+
+
+/*
+ * The switch dispatcher.  Rather than a new task for every switch
+ * event, events are put into a ring and a single task takes them out
+ * in order and processes them, as long as there are any.
+ *
+ * Switch handlers are allowed to sleep, though.  While the dispatcher
+ * is asleep inside a handler, a new event would have to wait for it,
+ * so a second dispatcher is started instead, and it takes over the
+ * ring.  The first one exits when its handler returns.  Events are
+ * always taken out in order, but as before, a handler that sleeps
+ * lets the ones after it run before it has finished.
+ */
+void switch_dispatch_task (void)
+{
+	U8 sw;
+	const task_pid_t self = task_getpid ();
+#ifdef CONFIG_SWITCH_TRACE
+	struct switch_trace trace;
+#endif
+
+	while (switch_event_head != switch_event_tail)
+	{
+		sw = switch_events[switch_event_head].sw;
+#ifdef DEBUGGER
+		{
+			U8 latency = (U8)get_sys_time () - switch_events[switch_event_head].time;
+			if (latency > sw_dispatch_latency[sw])
+				sw_dispatch_latency[sw] = latency;
+		}
+#endif
+#ifdef CONFIG_SWITCH_TRACE
+		trace = switch_events[switch_event_head].trace;
+		trace.at[SW_TRACE_START] = switch_trace_since (trace.raw);
+#endif
+		switch_event_head = (switch_event_head + 1) % SWITCH_EVENT_QUEUE_LEN;
+
+		/* Handlers can still find their switch from the task argument,
+		as when each had its own task */
+		task_set_arg (self, sw);
+		switch_dispatch_in_handler = TRUE;
+		switch_process (sw);
+#ifdef CONFIG_SWITCH_TRACE
+		trace.at[SW_TRACE_END] = switch_trace_since (trace.raw);
+		switch_trace_log (&trace);
+#endif
 
+		/* If another dispatcher took over while this one slept,
+		leave the rest to it.  If that one has already finished,
+		take over again. */
+		if (switch_dispatcher == 0)
+			switch_dispatcher = self;
+		else if (switch_dispatcher != self)
+			task_exit ();
+		switch_dispatch_in_handler = FALSE;
+	}
+	switch_dispatcher = 0;
 	task_exit ();
 }
 
 
+/** Schedule processing of a switch transition. */
+void switch_schedule (const U8 sw)
+{
+	U8 tail = (switch_event_tail + 1) % SWITCH_EVENT_QUEUE_LEN;
+	task_pid_t tp;
+
+	/* If the ring is full, fall back to a task for this switch */
+	if (unlikely (tail == switch_event_head))
+	{
+		tp = task_create_gid (GID_SW_HANDLER, switch_sched_task);
+		task_set_arg (tp, sw);
+		return;
+	}
+
+	switch_events[switch_event_tail].sw = sw;
+	switch_events[switch_event_tail].time = get_sys_time ();
+#ifdef CONFIG_SWITCH_TRACE
+	switch_trace_schedule (&switch_events[switch_event_tail].trace, sw);
+#endif
+	switch_event_tail = tail;
+
+	/* Start a dispatcher if there is none, or if the one there is
+	asleep in a handler.  Tasks are not preempted, so if the
+	dispatcher is in a handler now, it must be sleeping.  The dispatcher
+	can also have been stopped at the end of a ball, so look for it
+	rather than trusting switch_dispatcher. */
+	if (!switch_dispatcher || switch_dispatch_in_handler
+		|| !task_find_gid (GID_SW_DISPATCH))
+	{
+		switch_dispatcher = task_create_gid (GID_SW_DISPATCH, switch_dispatch_task);
+		switch_dispatch_in_handler = FALSE;
+	}
+}
+
+
 /**
- * Process a switch that has transitioned states.  All debouncing
- * is fully completed prior to this call.
+ * Process switches in one column that have transitioned states.  All
+ * debouncing is fully completed prior to this call.  BITS has one bit
+ * set for each such switch.
  *
- * The transition is first latched, so that polling the switch level
- * will return the new state.  At the same time, IRQ-level scanning
- * is restarted, so that further transitions can be detected.
+ * The transitions are first latched, so that polling the switches will
+ * return the new states.  At the same time, IRQ-level scanning is
+ * restarted, so that further transitions can be detected.
  *
- * Second, if the transition requires scheduling, a task is started
+ * Second, if a transition requires scheduling, a task is started
  * to handle it.  Eligibility depends on whether or not the switch
  * is declared as an edge switch (meaning it is scheduled on both
  * types of transitions) and whether or not it is an opto (i.e.
- * do we schedule open-to-closed or closed-to-open?)
+ * do we schedule open-to-closed or closed-to-open?)  This is worked
+ * out for the whole column at once.
  *
- * The switch is also known not to be in the debounce queue prior to this
- * function being called.
+ * The switches are also known not to be in the debounce queue prior to
+ * this function being called.
  */
-void switch_transitioned (const U8 sw)
+static void switch_transitioned (const U8 col, U8 bits)
 {
-	/* Latch the transition.  sw_logical is still an open/closed level.
+	U8 sw;
+#ifdef CONFIG_SWITCH_TRACE
+	const U8 latched = bits;
+#endif
+
+	/* Latch the transitions.  sw_logical is still an open/closed level.
 	 * By clearing the stable/unstable bits, IRQ will begin scanning
 	 * for new transitions at this point. */
 	rtt_disable ();
-	bit_toggle (sw_logical, sw);
-	bit_off (sw_stable, sw);
-	bit_off (sw_unstable, sw);
-	bit_off (sw_edge, sw);
+	sw_logical[col] ^= bits;
+	sw_stable[col] &= ~bits;
+	sw_unstable[col] &= ~bits;
+	sw_edge[col] &= ~bits;
 	rtt_enable ();
 
-	/* See if the transition requires scheduling.  It does if the
+	/* See which transitions require scheduling.  They do if the
 	   switch is declared 'edge' (it schedules when becoming active
-		or inactive), otherwise only becoming active.  Because most
-		switches are not edge, check for the active state first. */
-	if (switch_poll_logical (sw) || bit_test (mach_edge_switches, sw))
-	{
+		or inactive), otherwise only becoming active.  A switch is
+		active when its level differs from its opto bit. */
+	bits &= (sw_logical[col] ^ mach_opto_mask[col]) | mach_edge_switches[col];
+
 #ifdef CONFIG_BPT
-		/* One extra condition : do not schedule any switches when the
-		system is paused */
-		if (db_paused != 0)
-			return;
+	/* One extra condition : do not schedule any switches when the
+	system is paused */
+	if (db_paused != 0)
+		return;
 #endif
 
-		/* Start a task to process the switch event.
-		This task may sleep if necessary, but it should be as fast as possible
-		and push long-lived operations into separate background tasks.
-		It is possible for more than one instance of a task to exist for the same
-		switch, if valid debounced transitions occur quickly. */
-		task_pid_t tp = task_create_gid (GID_SW_HANDLER, switch_sched_task);
-		task_set_arg (tp, sw);
-	}
+	/* Schedule each switch event.  Handlers may sleep if necessary,
+	but they should be as fast as possible and push long-lived
+	operations into separate background tasks. */
+	for (sw = col * 8; bits; bits >>= 1, sw++)
+		if (bits & 1)
+			switch_schedule (sw);
+
+#ifdef CONFIG_SWITCH_TRACE
+	/* The next reading of these switches starts a new trace. */
+	rtt_disable ();
+	sw_trace_active[col] &= ~latched;
+	rtt_enable ();
+#endif
 }
 
 
-/** Add a new entry to the switch queue. */
-void switch_queue_add (const switchnum_t sw)
+/** Add switches in one column to the switch queue, starting their
+debounce timers. */
+static void switch_queue_add (const U8 col, const U8 bits)
 {
-	if (switch_queue_top < switch_queue + MAX_QUEUED_SWITCHES)
+	U8 sw, bit, n;
+	task_ticks_t timer;
+
+	for (sw = col * 8, bit = 1; bit; bit <<= 1, sw++)
 	{
+		if (!(bits & bit))
+			continue;
 		dbprintf ("adding %d to queue\n", sw);
-		switch_queue_top->id = sw;
-		switch_queue_top->timer = switch_lookup(sw)->debounce;
-		bit_on (sw_queued, sw);
-		switch_queue_top++;
+		timer = switch_lookup (sw)->debounce;
+		if (timer >= (1 << SWITCH_DEBOUNCE_BITS))
+			timer = (1 << SWITCH_DEBOUNCE_BITS) - 1;
+		for (n = 0; n < SWITCH_DEBOUNCE_BITS; n++, timer >>= 1)
+		{
+			if (timer & 1)
+				sw_debounce_timer[n][col] |= bit;
+			else
+				sw_debounce_timer[n][col] &= ~bit;
+		}
 	}
+	sw_queued[col] |= bits;
 }
 
 
-/** Remove an entry from the switch queue */
-void switch_queue_remove (pending_switch_t *entry)
-{
-	/* Copy the last entry in the queue into the slot being deleted. */
-	dbprintf ("removing %d from queue\n", entry->id);
-	bit_off (sw_queued, entry->id);
-	entry->id = (switch_queue_top-1)->id;
-	entry->timer = (switch_queue_top-1)->timer;
-	switch_queue_top--;
-}
-
 /** Initialize the switch queue */
 void switch_queue_init (void)
 {
-	switch_queue_top = switch_queue;
 	memset (sw_stable, 0, sizeof (sw_stable));
 	memset (sw_unstable, 0, sizeof (sw_unstable));
 	memset (sw_queued, 0, sizeof (sw_queued));
@@ -418,58 +655,72 @@ void switch_queue_init (void)
 
 /** Service the switch queue.  This function is called
  * periodically to see if any pending switch transitions have
- * completed their debounce time.  If any switch becomes
- * unstable before the period expires, it will be removed
- * from the queue prior to this function being called.  So
- * all that is needed here is to decrement the timers, and if
- * one reaches zero, consider that switch transitioned.
+ * completed their debounce time.  All that is needed here is to
+ * count down the timers, and if one reaches zero, consider that
+ * switch transitioned, unless it became unstable in the meantime.
+ *
+ * The timers of a column are counted down together: subtracting 1
+ * flips the low bit of every running timer, and the borrow moves up
+ * to the next bit only for those whose bit was 0.
  */
 void switch_service_queue (void)
 {
-	pending_switch_t *entry;
+	U8 col, n, tick;
 	U8 elapsed_time;
+	U8 running, borrow, old, done;
 
 	/* See how long since the last time we serviced the queue.
 	This is in 16ms ticks. */
 	elapsed_time = get_elapsed_time (switch_last_service_time);
+	switch_last_service_time = get_sys_time ();
 
-	entry = switch_queue;
-	while (unlikely (entry < switch_queue_top))
+	for (col = 0; col < SWITCH_BITS_SIZE; col++)
 	{
-		entry->timer -= elapsed_time;
-		if (entry->timer <= 0)
-		{
-			/* Debounce interval is complete. */
+		if (likely (sw_queued[col] == 0))
+			continue;
 
-			/* See if the switch held its state during the debounce period */
-			if (bit_test (sw_unstable, entry->id))
-			{
-				/* Debouncing failed, so don't process the switch.
-				 * Restart IRQ-level scanning. */
-				rtt_disable ();
-				bit_off (sw_stable, entry->id);
-				bit_off (sw_unstable, entry->id);
-				rtt_enable ();
-			}
-			else
+		for (tick = 0; tick < elapsed_time; tick++)
+		{
+			running = 0;
+			for (n = 0; n < SWITCH_DEBOUNCE_BITS; n++)
+				running |= sw_debounce_timer[n][col];
+			borrow = running & sw_queued[col];
+			if (borrow == 0)
+				break;
+			for (n = 0; n < SWITCH_DEBOUNCE_BITS && borrow; n++)
 			{
-				/* Debouncing succeeded, so process the switch */
-				switch_transitioned (entry->id);
+				old = sw_debounce_timer[n][col];
+				sw_debounce_timer[n][col] = old ^ borrow;
+				borrow &= ~old;
 			}
-
-			/* The queue entry can be removed now.
-			   Note we do not advance the 'entry' pointer in
-				this case, as we may have copied a legitimate
-				entry here. */
-			switch_queue_remove (entry);
 		}
-		else
+
+		/* Debounce interval is complete for those with a zero timer */
+		done = sw_queued[col];
+		for (n = 0; n < SWITCH_DEBOUNCE_BITS; n++)
+			done &= ~sw_debounce_timer[n][col];
+		if (done == 0)
+			continue;
+
+		/* The queue entries can be removed now. */
+		sw_queued[col] &= ~done;
+
+		/* See if the switches held their state during the debounce period.
+		 * If not, debouncing failed, so don't process those switches;
+		 * just restart IRQ-level scanning. */
+		old = done & sw_unstable[col];
+		if (old)
 		{
-			entry++;
+			rtt_disable ();
+			sw_stable[col] &= ~old;
+			sw_unstable[col] &= ~old;
+			rtt_enable ();
 		}
-	}
 
-	switch_last_service_time = get_sys_time ();
+		/* Debouncing succeeded for the rest, so process them */
+		if (done &= ~old)
+			switch_transitioned (col, done);
+	}
 }
 
 
@@ -486,14 +737,17 @@ static inline void switch_matrix_dump (const char *name, U8 *matrix)
 
 void switch_queue_dump (void)
 {
-	pending_switch_t *entry = switch_queue;
+	U8 sw, n, timer;
 
-	dbprintf ("Switch queue base: %p\n", switch_queue);
-	dbprintf ("Switch queue top: %p\n", switch_queue_top);
-	while (entry != switch_queue_top)
+	for (sw = 0; sw < SWITCH_BITS_SIZE * 8; sw++)
 	{
-		dbprintf ("Pending: SW%d  %d\n", entry->id, entry->timer);
-		entry++;
+		if (!bitarray_test (sw_queued, sw))
+			continue;
+		timer = 0;
+		for (n = 0; n < SWITCH_DEBOUNCE_BITS; n++)
+			if (bitarray_test (sw_debounce_timer[n], sw))
+				timer |= 1 << n;
+		dbprintf ("Pending: SW%d  %d\n", sw, timer);
 	}
 	switch_matrix_dump ("Raw     ", sw_raw);
 	switch_matrix_dump ("Logical ", sw_logical);
@@ -502,32 +756,22 @@ void switch_queue_dump (void)
 	switch_matrix_dump ("Stable  ", sw_stable);
 	switch_matrix_dump ("Unstable", sw_unstable);
 	switch_matrix_dump ("Queued  ", sw_queued);
-}
-#endif /* DEBUGGER */
-
 
-/**
- * Handle a switch that has just become stable; i.e. it changed
- * and held steady for at least 2 consecutive readings.  It is
- * also known not to be in the heavy debounce queue already.
- *
- * If the switch requires a longer debounce period, then it is
- * put into a queue and we wait a little while to see if it
- * remains stable, then it will be scheduled.
- */
-static void switch_update_stable (const U8 sw)
-{
-	/* Queue the switch if it requires further debouncing.
-	 * Otherwise, it is eligible for scheduling. */
-	if (switch_lookup (sw)->debounce != 0)
-		switch_queue_add (sw);
-	else
-		switch_transitioned (sw);
+	for (sw = 0; sw < NUM_SWITCHES; sw++)
+		if (sw_dispatch_latency[sw])
+			dbprintf ("Latency: SW%d  %d\n", sw, sw_dispatch_latency[sw]);
 }
+#endif /* DEBUGGER */
 
 
 /** Periodic switch processing.  This function is called frequently
  * to scan pending switches and spawn new tasks to handle them.
+ *
+ * Each bit in sw_stable indicates a switch that just transitioned
+ * and may need to be processed.  Those not already queued are
+ * either queued, if they require further debouncing, or otherwise
+ * are eligible for scheduling; each column is split between the
+ * two with a mask.
  */
 void switch_periodic (void)
 {
@@ -566,17 +810,12 @@ void switch_periodic (void)
 	task_dispatching_ok = TRUE;
 	for (col=0; col < SWITCH_BITS_SIZE; col++)
 	{
-		/* Each bit in sw_stable indicates a switch
-		that just transitioned and may need to be processed */
-		if (unlikely (rows = sw_stable[col]))
+		if (unlikely (rows = sw_stable[col] & ~sw_queued[col]))
 		{
-			U8 sw = col * 8;
-			do {
-				if ((rows & 1) && !bit_test (sw_queued, sw))
-					switch_update_stable (sw);
-				rows >>= 1;
-				sw++;
-			} while (rows);
+			if (rows & sw_long_debounce[col])
+				switch_queue_add (col, rows & sw_long_debounce[col]);
+			if (rows &= ~sw_long_debounce[col])
+				switch_transitioned (col, rows);
 		}
 		task_runs_long ();
 	}
@@ -634,6 +873,8 @@ CALLSET_ENTRY (switch, idle_every_second)
 /** Initialize the switch subsystem */
 void switch_init (void)
 {
+	U8 sw;
+
 	/* Initialize the short timer so switch scanning is enabled */
 	sw_short_timer = 0;
 
@@ -645,7 +886,19 @@ void switch_init (void)
 	memcpy (sw_logical, mach_opto_mask, SWITCH_BITS_SIZE);
 	memset (sw_edge, 0, sizeof (switch_bits_t));
 
+	/* Note which switches need a longer debounce */
+	memset (sw_long_debounce, 0, sizeof (switch_bits_t));
+	for (sw = 0; sw < NUM_SWITCHES; sw++)
+		if (switch_lookup (sw)->debounce != 0)
+			bitarray_set (sw_long_debounce, sw);
+
 	/* Initialize the switch queue */
 	switch_queue_init ();
+
+	/* Initialize the dispatcher */
+	switch_event_head = switch_event_tail = 0;
+	switch_dispatcher = 0;
+	switch_dispatch_in_handler = FALSE;
+	memset (switch_lamp_pulses, 0, sizeof (switch_lamp_pulses));
 }
 
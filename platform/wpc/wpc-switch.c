@@ -167,6 +167,8 @@ void switch_rtt (void)
 	/* Poll the Fliptronic flipper switches */
 	switch_rowpoll (9);
 #endif
+
+	switch_trace_scan ();
 }
 
 
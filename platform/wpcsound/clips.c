@@ -0,0 +1,46 @@
+/*
+ * Copyright 2008 by Brian Dominy <brian@oddchange.com>
+ *
+ * This file is part of FreeWPC.
+ *
+ * FreeWPC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeWPC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeWPC; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <freewpc.h>
+#include "stream.h"
+
+/*
+ * The clips that the host can start.  The sample data of each clip is
+ * converted from a sound file by bin2c, into a C file that only defines
+ * the array; those files are included here, so that the size of each
+ * array is known, and so that nothing here is lost when they are made
+ * again.
+ */
+
+#include "bell.c"
+
+/** The startup gong.  It is drawn by hand, one step every 9 FIRQs. */
+const struct wpcs_clip bell_clip = {
+	CLIP_DAC, CLIP_PAGE_FIXED, bell_data, sizeof (bell_data), 9
+};
+
+/** The clips that the host can start, by number.  Clip 0 is never
+started, as 0 means 'music off' to the host. */
+const struct wpcs_clip *const wpcs_clip_table[] = {
+	NULL,
+	&bell_clip,
+};
+
+const U8 wpcs_clip_count = sizeof (wpcs_clip_table) / sizeof (wpcs_clip_table[0]);
@@ -19,40 +19,145 @@
  */
 
 #include <freewpc.h>
+#include "stream.h"
 
-/** A pointer to the next byte of CVSD data to send */
-U8 *cvsd_output;
+/*
+ * The CVSD decoder takes one bit per clock, at about 22khz, so the
+ * FIRQ sends CVSD_BITS_PER_TICK of them each time, and clips are
+ * converted at that many times the FIRQ rate.  Like the DAC, it
+ * takes its bytes from a buffer in RAM with two halves; the main loop
+ * refills the half that has been sent, from ROM.
+ */
+
+/** A pointer to the next byte of CVSD data to be read from ROM */
+const U8 *cvsd_output;
 
 /** A pointer to one past the end of the CVSD data.  When
-the output pointer reaches this value, the CVSD is stopped. */
-U8 *cvsd_end;
+the output pointer reaches this value, no more is read. */
+const U8 *cvsd_end;
 
 /** The page of ROM in which the CVSD data comes from. */
 U8 cvsd_page;
 
-U8 cvsd_data;
+/** The bits of the current byte not yet sent */
+__fastram__ U8 cvsd_data;
+
+/** The number of bits left in cvsd_data */
+__fastram__ U8 cvsd_count;
+
+/** Both halves of the CVSD buffer */
+U8 cvsd_buffer[CVSD_BUFFER_SIZE * 2];
+
+/** The next byte to be taken by the FIRQ */
+__fastram__ U8 *cvsd_next;
+
+/** The half of the buffer to be filled next */
+U8 cvsd_next_fill;
 
-U8 cvsd_count;
+/** Nonzero while CVSD is playing */
+__fastram__ U8 cvsd_active;
 
+/** The number of refills since the end of the clip was read */
+U8 cvsd_drain;
 
-/** Service the CVSD device, by sending at most a single bit. */
+
+/** Service the CVSD device, by clocking out the next bits.  This is
+called from the FIRQ, so it is kept short: one byte is taken from
+RAM every second call, and each bit is a write of the data line and
+a pulse of the clock. */
 void cvsd_service (void)
 {
+	U8 n;
+
+	if (!cvsd_active)
+		return;
+
+	if (cvsd_count == 0)
+	{
+		cvsd_data = *cvsd_next++;
+		if (cvsd_next == cvsd_buffer + sizeof (cvsd_buffer))
+			cvsd_next = cvsd_buffer;
+		cvsd_count = 8;
+	}
+
+	for (n = 0; n < CVSD_BITS_PER_TICK; n++)
+	{
+		writeb (WPCS_CVSD_DATA, cvsd_data & 0x80 ? 1 : 0);
+		writeb (WPCS_CVSD_CLOCK, 0);
+		cvsd_data <<= 1;
+	}
+	cvsd_count -= CVSD_BITS_PER_TICK;
+}
+
+
+/** Fill one half of the CVSD buffer.  Past the end of the clip, it is
+filled with alternating bits, which the decoder turns into silence. */
+static void cvsd_fill_half (U8 *out)
+{
+	U8 n;
+
+	for (n = 0; n < CVSD_BUFFER_SIZE; n++)
+	{
+		if (cvsd_output)
+		{
+			*out++ = clip_read (cvsd_output++, cvsd_page);
+			if (cvsd_output == cvsd_end)
+				cvsd_output = NULL;
+		}
+		else
+			*out++ = 0x55;
+	}
+}
+
+
+/** Refill the half of the CVSD buffer that has been sent.  Once the end
+of the clip has been sent too, the CVSD is stopped. */
+void cvsd_fill (void)
+{
+	if (!cvsd_active)
+		return;
+	if ((cvsd_next >= cvsd_buffer + CVSD_BUFFER_SIZE) == cvsd_next_fill)
+		return;
+
+	/* The half now playing may hold the end of the clip; the one after
+	it is all silence.  Stop when that one comes back to be refilled. */
+	if (cvsd_output == NULL && ++cvsd_drain == 2)
+	{
+		cvsd_stop ();
+		return;
+	}
+
+	cvsd_fill_half (cvsd_buffer + (cvsd_next_fill ? CVSD_BUFFER_SIZE : 0));
+	cvsd_next_fill ^= 1;
 }
 
 
-void cvsd_start (U8 *start, U8 *end, U8 page)
+void cvsd_start (const U8 *start, const U8 *end, U8 page)
 {
-	cvsd_data = far_read8 (start++, page);
+	cvsd_active = 0;
 	cvsd_output = start;
 	cvsd_end = end;
-	cvsd_count = 8;
+	cvsd_page = page;
+	cvsd_drain = 0;
+
+	/* Fill the first half now and start sending it; the second half
+	is filled by the main loop while the first plays. */
+	cvsd_fill_half (cvsd_buffer);
+	cvsd_next = cvsd_buffer;
+	cvsd_next_fill = 1;
+	cvsd_count = 0;
+	cvsd_active = 1;
 }
 
 
 void cvsd_stop (void)
 {
-	cvsd_count = 0;
+	cvsd_active = 0;
 	cvsd_output = NULL;
 }
 
+
+void cvsd_init (void)
+{
+	cvsd_stop ();
+}
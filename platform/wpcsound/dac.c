@@ -1,3 +1,155 @@
+/*
+ * Copyright 2008 by Brian Dominy <brian@oddchange.com>
+ *
+ * This file is part of FreeWPC.
+ *
+ * FreeWPC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeWPC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeWPC; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
 
 #include <freewpc.h>
+#include "stream.h"
 
+/*
+ * The DAC output buffer is split into two halves.  The FIRQ plays one
+ * half while the main loop mixes the next block of samples into the
+ * other; when the FIRQ moves on to the second half, the first one is
+ * refilled, and so on.  This keeps the FIRQ down to a load, a store and
+ * a compare, and keeps the far reads from ROM in the main loop.
+ *
+ * Each stream is one clip being played.  Samples are unsigned, centered
+ * at 0x80; the streams are added as signed values and clipped.  A clip
+ * recorded at a lower rate than the FIRQ has each of its samples
+ * repeated 'divider' times.
+ */
+
+struct dac_stream
+{
+	/** The next sample to be read, or NULL if the stream is idle */
+	const U8 *data;
+
+	/** One past the last sample */
+	const U8 *end;
+
+	/** The ROM page of the samples */
+	U8 page;
+
+	/** The number of FIRQs that each sample is played for */
+	U8 divider;
+
+	/** The number of FIRQs left to play the current sample for; when
+	this and 'data' are both zero, the stream is idle */
+	U8 hold;
+
+	/** The current sample, as a signed value */
+	S8 sample;
+};
+
+struct dac_stream dac_streams[DAC_STREAMS];
+
+/** Both halves of the output buffer */
+U8 dac_buffer[DAC_BUFFER_SIZE * 2];
+
+/** The next sample to be written by the FIRQ */
+__fastram__ U8 *dac_output;
+
+/** The half of the buffer to be filled next */
+U8 dac_next_fill;
+
+
+/** Start playing a DAC clip.  An idle stream is used if there is one;
+otherwise the clip replaces the one in the first stream. */
+void dac_start (const struct wpcs_clip *clip)
+{
+	struct dac_stream *s;
+
+	for (s = dac_streams; s < dac_streams + DAC_STREAMS; s++)
+		if (s->data == NULL && s->hold == 0)
+			break;
+	if (s == dac_streams + DAC_STREAMS)
+		s = dac_streams;
+
+	/* The FIRQ never looks at the streams, so no locking is needed */
+	s->page = clip->page;
+	s->divider = clip->divider;
+	s->hold = 0;
+	s->end = clip->start + clip->length;
+	s->data = clip->start;
+}
+
+
+/** Stop all DAC clips.  What has already been mixed still plays out,
+which is at most one buffer. */
+void dac_stop (void)
+{
+	U8 n;
+	for (n = 0; n < DAC_STREAMS; n++)
+	{
+		dac_streams[n].data = NULL;
+		dac_streams[n].hold = 0;
+	}
+}
+
+
+/** Mix the next block of samples into the half of the output buffer
+that is not playing, if it has been played out. */
+void dac_fill (void)
+{
+	U8 *out;
+	U8 n;
+	S16 mix;
+	struct dac_stream *s;
+
+	/* Wait until the FIRQ is in the other half.  dac_output is read
+	in a single instruction, so it can't change underneath. */
+	if ((dac_output >= dac_buffer + DAC_BUFFER_SIZE) == dac_next_fill)
+		return;
+
+	out = dac_buffer + (dac_next_fill ? DAC_BUFFER_SIZE : 0);
+	for (n = 0; n < DAC_BUFFER_SIZE; n++)
+	{
+		mix = 0;
+		for (s = dac_streams; s < dac_streams + DAC_STREAMS; s++)
+		{
+			if (s->hold == 0)
+			{
+				if (s->data == NULL)
+					continue;
+				s->sample = (S8)(clip_read (s->data++, s->page) ^ 0x80);
+				if (s->data == s->end)
+					s->data = NULL;
+				s->hold = s->divider;
+			}
+			s->hold--;
+			mix += s->sample;
+		}
+
+		if (mix > 0x7F)
+			mix = 0x7F;
+		else if (mix < -0x80)
+			mix = -0x80;
+		*out++ = mix + 0x80;
+	}
+
+	dac_next_fill ^= 1;
+}
+
+
+void dac_init (void)
+{
+	dac_stop ();
+	memset (dac_buffer, 0x80, sizeof (dac_buffer));
+	dac_output = dac_buffer;
+	dac_next_fill = 1;
+}
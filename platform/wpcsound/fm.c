@@ -50,6 +50,9 @@ void fm_init (void)
 		fm_write_inline (reg, 0, 1);
 	fm_write_inline (0xFF, 0, 1);
 
+	/* Timer A drives the FIRQ, and so the rate at which DAC samples and
+	CVSD bits are sent.  1014 gives 64 * 10 clocks of the 3.58Mhz FM clock,
+	or about 5.6khz, which is WPCS_SAMPLE_RATE in the Makefile. */
 	fm_write_inline (FM_ADDR_CLOCK_CTRL, FM_TIMER_FRESETA + FM_TIMER_FRESETB, 1);
 	fm_write_inline (FM_ADDR_CLOCK_A1, 0xFD, 1);
 	fm_write_inline (FM_ADDR_CLOCK_A2, 0x02, 1);
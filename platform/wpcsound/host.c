@@ -20,6 +20,27 @@
 
 #include <freewpc.h>
 #include <queue.h>
+#include <system/sound.h>
+#include "stream.h"
+
+/*
+ * The host protocol follows the WPC sound board, so that the CPU board
+ * can use the same sound calls, and the codes are the ones it sends
+ * (see system/sound.h).  Most bytes are a single command: a clip
+ * number, which starts that entry of the clip table, or a control code.
+ * A few control codes take arguments in the bytes that follow.
+ *
+ * Clip numbers are the codes below SND_DROP_DAC_VOLUME, those from the
+ * end of that range up to SND_MUSIC_FASTER, and those with the high bit
+ * set.  The rest are control codes; those not handled here are ignored,
+ * so that a stray byte never starts a clip.
+ */
+
+/** The sound code version, returned for SND_GET_VERSION_CMD */
+#define WPCS_VERSION 1
+
+/** The number of SND_DROP_DAC_VOLUME codes */
+#define WPCS_DAC_VOLUME_STEPS 16
 
 #define HOST_BUFFER_SIZE 16
 
@@ -76,8 +97,106 @@ bool host_read_ready (void)
 	return !queue_empty_p (&host_read_queue.header);
 }
 
+/** The control code whose arguments are being received, or 0 */
+U8 host_cmd;
+
+/** The number of argument bytes received so far */
+U8 host_argc;
+
+/** The arguments received so far */
+U8 host_args[2];
+
+
+/** Start a clip from the clip table */
+static void host_start_clip (U16 n)
+{
+	const struct wpcs_clip *clip;
+
+	if (n >= wpcs_clip_count || (clip = wpcs_clip_table[n]) == NULL)
+		return;
+	if (clip->type == CLIP_CVSD)
+		cvsd_start (clip->start, clip->start + clip->length, clip->page);
+	else
+		dac_start (clip);
+}
+
+
+/** Return TRUE if a byte from the host is a clip number */
+static bool host_clip_code_p (U8 val)
+{
+	return val < SND_DROP_DAC_VOLUME (0)
+		|| (val >= SND_DROP_DAC_VOLUME (WPCS_DAC_VOLUME_STEPS) && val < SND_MUSIC_FASTER)
+		|| (val & 0x80);
+}
+
+
+/** Handle one byte from the host */
+static void host_command (U8 val)
+{
+	if (host_cmd)
+	{
+		host_args[host_argc++] = val;
+		switch (host_cmd)
+		{
+			case SND_SET_VOLUME_CMD:
+				if (host_argc < 2)
+					return;
+				if (host_args[1] == (U8)~host_args[0])
+					volume_set (host_args[0]);
+				break;
+
+			case SND_START_EXTENDED:
+				host_start_clip (0x100 + val);
+				break;
+		}
+		host_cmd = 0;
+		return;
+	}
+
+	switch (val)
+	{
+		case SND_SET_VOLUME_CMD:
+		case SND_START_EXTENDED:
+			host_cmd = val;
+			host_argc = 0;
+			break;
+
+		case SND_GET_VERSION_CMD:
+			host_write (WPCS_VERSION);
+			break;
+
+		case SND_STOP_SOUND:
+			dac_stop ();
+			cvsd_stop ();
+			break;
+
+		case SND_STOP_MUSIC:
+			break;
+
+		case SND_STOP_DAC:
+			dac_stop ();
+			break;
+
+		default:
+			if (host_clip_code_p (val))
+				host_start_clip (val);
+			break;
+	}
+}
+
+
+/** Handle all of the commands received from the host.  This is called
+from the main loop. */
+void host_service (void)
+{
+	while (host_read_ready ())
+		host_command (host_read ());
+}
+
+
 void host_init (void)
 {
+	host_cmd = 0;
 	queue_init (&host_write_queue.header);
 	queue_init (&host_read_queue.header);
 }
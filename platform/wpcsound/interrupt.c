@@ -19,6 +19,7 @@
  */
 
 #include <freewpc.h>
+#include "stream.h"
 
 extern __fastram__ U8 tick_count;
 
@@ -32,22 +33,21 @@ __interrupt__ void wpcs_invalid_interrupt (void)
 }
 
 
-extern U8 bell_data[0x2000];
+extern __fastram__ U8 *dac_output;
+extern U8 dac_buffer[];
 
-U8 *dac_data;
+void cvsd_service (void);
 
-U8 dac_flag;
 
-U8 count;
-
-extern inline void dac_refresh (const U8 n)
+/** Write the next sample from the DAC output buffer.  The buffer always
+holds something to play, silence if nothing else, so there is no need
+to check for the end of a clip here; that is done when the buffer is
+filled. */
+extern inline void dac_refresh (void)
 {
-	if (dac_flag)
-	{
-		writeb (WPCS_DAC, *dac_data++);
-		if (n == 1 && dac_data == bell_data + sizeof (bell_data))
-			dac_flag = 0;
-	}
+	writeb (WPCS_DAC, *dac_output++);
+	if (dac_output == dac_buffer + DAC_BUFFER_SIZE * 2)
+		dac_output = dac_buffer;
 }
 
 
@@ -55,32 +55,28 @@ extern inline void dac_refresh (const U8 n)
  * Handles the periodic interrupt on the FIRQ.
  * This interrupt occurs at 5.5khz.
  *
- * 8-bit DAC samples are encoded at 11khz and thus 2 must be
+ * 8-bit DAC samples are encoded at the same rate, and thus 1 is
  * sent.
  *
  * 1-bit CVSD samples are encoded at 22khz and thus 4 must be
  * sent.
  *
  * This routine only has about 350 cycles to get the job done
- * before another interrupt will occur.  Yikes!
+ * before another interrupt will occur.  Yikes!  So it does no
+ * mixing and no bank switching; it only takes the next sample
+ * and the next CVSD bits out of buffers in RAM, which the main loop
+ * keeps filled.
  */
 __interrupt__ void wpcs_periodic_interrupt (void)
 {
 	m6809_firq_save_regs ();
 
 	fm_timer_restart (1);
-	//dac_refresh (0);
+	dac_refresh ();
+	cvsd_service ();
 	tick_count++;
 	host_send ();
 
-	if (count == 0)
-	{
-		dac_refresh (1);
-		count = 8;
-	}
-	else
-		count--;
-
 	m6809_firq_restore_regs ();
 }
 
@@ -19,6 +19,7 @@
  */
 
 #include <freewpc.h>
+#include "stream.h"
 
 /** Normally we don't like to use 'int', but this code interfaces
  * with the standard library, so make absolutely sure we are using
@@ -55,9 +56,7 @@ void wpcs_hardware_init (void)
 }
 
 
-extern U8 bell_data[];
-extern U8 *dac_data;
-extern U8 dac_flag;
+extern const struct wpcs_clip bell_clip;
 
 
 __noreturn__ void main (void)
@@ -68,9 +67,11 @@ __noreturn__ void main (void)
 	VOIDCALL (host_init);
 	VOIDCALL (volume_init);
 	VOIDCALL (fm_init);
+	VOIDCALL (dac_init);
+	VOIDCALL (cvsd_init);
 
-	dac_data = bell_data;
-	dac_flag = 1;
+	/* Play the startup gong */
+	dac_start (&bell_clip);
 
 	/* Wait for the host to be ready. */
 	for (count = 0; count < 0xFFF0; count++)
@@ -89,8 +90,13 @@ __noreturn__ void main (void)
 
 	enable_interrupts ();
 
+	/* All of the work that is too slow for the FIRQ is done here:
+	commands from the host, and keeping the output buffers full. */
 	for (;;)
 	{
+		host_service ();
+		dac_fill ();
+		cvsd_fill ();
 #if 0
 		U8 val;
 		for (val=0; val<0xff; val++)
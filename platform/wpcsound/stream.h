@@ -0,0 +1,99 @@
+/*
+ * Copyright 2008 by Brian Dominy <brian@oddchange.com>
+ *
+ * This file is part of FreeWPC.
+ *
+ * FreeWPC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeWPC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeWPC; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _WPCSOUND_STREAM_H
+#define _WPCSOUND_STREAM_H
+
+/* The sound board plays clips from banked ROM.  A clip is either 8-bit
+ * unsigned DAC samples or 1-bit CVSD data.  The periodic FIRQ only ever
+ * reads from small buffers in RAM; the main loop keeps those filled from
+ * ROM, which is where the time-consuming bank switching happens.
+ *
+ * Everything is paced by the FIRQ, which fm_init sets to about 5.6khz
+ * (WPCS_SAMPLE_RATE in the Makefile).  Each FIRQ plays one DAC sample
+ * and sends CVSD_BITS_PER_TICK bits of CVSD, so the Makefile converts
+ * DAC clips at that rate and CVSD clips at 4 times it. */
+
+/** The CVSD decoder latches.  A write to WPCS_CVSD_DATA latches the
+data bit from bit 0 and drops the clock; a write to WPCS_CVSD_CLOCK
+raises it again, which clocks the bit in. */
+#define WPCS_CVSD_DATA 0x2C00
+#define WPCS_CVSD_CLOCK 0x3400
+
+/** The number of DAC clips that can be mixed together */
+#define DAC_STREAMS 2
+
+/** The size of each half of the DAC output buffer, in samples */
+#define DAC_BUFFER_SIZE 32
+
+/** The size of each half of the CVSD output buffer, in bytes */
+#define CVSD_BUFFER_SIZE 8
+
+/** The number of CVSD bits sent on each FIRQ */
+#define CVSD_BITS_PER_TICK 4
+
+#define CLIP_DAC 0
+#define CLIP_CVSD 1
+
+/** The page of a clip that is linked with the code, in the fixed
+region, and so can be read without switching banks */
+#define CLIP_PAGE_FIXED 0xFF
+
+/** A clip in ROM */
+struct wpcs_clip
+{
+	/** CLIP_DAC or CLIP_CVSD */
+	U8 type;
+
+	/** The ROM page and address of the data */
+	U8 page;
+	const U8 *start;
+	U16 length;
+
+	/** For DAC clips, the number of FIRQs that each sample is played
+	for.  This is 1 for clips converted at the FIRQ rate. */
+	U8 divider;
+};
+
+
+/** Read one byte of a clip */
+extern inline U8 clip_read (const U8 *addr, U8 page)
+{
+	if (page == CLIP_PAGE_FIXED)
+		return *addr;
+	return far_read8 (addr, page);
+}
+
+extern const struct wpcs_clip *const wpcs_clip_table[];
+extern const U8 wpcs_clip_count;
+
+void dac_start (const struct wpcs_clip *clip);
+void dac_stop (void);
+void dac_fill (void);
+void dac_init (void);
+void cvsd_start (const U8 *start, const U8 *end, U8 page);
+void cvsd_stop (void);
+void cvsd_fill (void);
+void cvsd_init (void);
+void host_write (U8 val);
+void host_service (void);
+void volume_set (U8 new_volume);
+
+#endif /* _WPCSOUND_STREAM_H */
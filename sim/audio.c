@@ -0,0 +1,379 @@
+/*
+ * Copyright 2011 by Brian Dominy <brian@oddchange.com>
+ *
+ * This file is part of FreeWPC.
+ *
+ * FreeWPC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeWPC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeWPC; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <freewpc.h>
+#include <simulation.h>
+
+/* This module plays the sound board.  There is no sound ROM to decode, so
+	each command is rendered as a tone whose pitch is taken from its code:
+	music codes (high byte zero) loop until replaced or stopped by MUS_OFF,
+	and other codes are short effects with a decaying envelope.  This is
+	enough to hear and to measure what the game asks for, and when.
+
+	Commands are passed from the writer to the mixer through a
+	single-producer, single-consumer ring, so the writer never blocks
+	and never takes a lock even if it runs on another thread.  Every
+	AUDIO_PERIOD ms of simulated time, the mixer takes the new commands,
+	assigns them to voices, and mixes one period of all active voices
+	into the output ring.  The sink then takes one period back out of it;
+	the ring holds 'audio.buffer' ms in between, like the buffer of a
+	real audio device.
+
+	The sink is a file: a .wav file gets a WAV header, any other name gets
+	raw 16-bit samples, and a name beginning with '|' is run as a command
+	that reads them, for example "|aplay -q -f S16_LE -r 16000", to play
+	them on a local device.
+
+	The latency of a command is the time from its write until its first
+	sample leaves the ring.  The count and the worst case are in
+	'audio.commands' and 'audio.latency'. */
+
+#define AUDIO_RATE 16000
+#define AUDIO_PERIOD 10
+#define AUDIO_PERIOD_SAMPLES (AUDIO_RATE * AUDIO_PERIOD / 1000)
+#define AUDIO_VOICES 8
+#define AUDIO_QUEUE_LEN 64
+#define AUDIO_RING_SAMPLES AUDIO_RATE
+
+/* Effects play for 250ms */
+#define AUDIO_EFFECT_SAMPLES (AUDIO_RATE / 4)
+
+#define AUDIO_AMPLITUDE 4000
+
+struct audio_command
+{
+	U16 cmd;
+	unsigned long time;
+};
+
+/** The command ring.  Only the writer changes the head and only the
+mixer changes the tail. */
+static struct {
+	unsigned int head;
+	unsigned int tail;
+	struct audio_command elems[AUDIO_QUEUE_LEN];
+} audio_queue;
+
+struct audio_voice
+{
+	/** The command being played, or 0 if the voice is free */
+	U16 cmd;
+
+	/** Nonzero if it loops, for music */
+	int loop;
+
+	/** The phase and phase step of the tone, in 1/65536 cycles */
+	unsigned int phase;
+	unsigned int step;
+
+	/** The samples left to play, for effects */
+	unsigned int left;
+
+	/** When it was started, to pick a voice to steal */
+	unsigned long started;
+};
+
+/** Voice 0 is kept for music */
+static struct audio_voice audio_voices[AUDIO_VOICES];
+
+/** The output ring */
+static S16 audio_ring[AUDIO_RING_SAMPLES];
+static unsigned int audio_ring_head;
+static unsigned int audio_ring_count;
+
+/** The sink, and how it was opened */
+static FILE *audio_out;
+static int audio_out_pipe;
+static int audio_out_wav;
+static unsigned long audio_out_samples;
+
+/** The name of the sink, from --audio */
+const char *audio_file;
+
+/** The number of ms of output kept buffered */
+int audio_buffer_ms = 40;
+
+int audio_commands;
+int audio_latency_max;
+static unsigned long audio_latency_total;
+int audio_queue_drops;
+int audio_voice_steals;
+
+
+/** Queue a command from the sound board interface.  This is the only
+producer of the command ring. */
+void audio_write (U16 cmd)
+{
+	unsigned int head, next;
+
+	if (!audio_out)
+		return;
+
+	head = __atomic_load_n (&audio_queue.head, __ATOMIC_RELAXED);
+	next = (head + 1) % AUDIO_QUEUE_LEN;
+	if (next == __atomic_load_n (&audio_queue.tail, __ATOMIC_ACQUIRE))
+	{
+		audio_queue_drops++;
+		return;
+	}
+	audio_queue.elems[head].cmd = cmd;
+	audio_queue.elems[head].time = realtime_read ();
+	__atomic_store_n (&audio_queue.head, next, __ATOMIC_RELEASE);
+}
+
+
+/** Start a voice for a command */
+static void audio_voice_start (U16 cmd, unsigned long now)
+{
+	struct audio_voice *voice;
+	unsigned int n;
+
+	if ((cmd >> 8) == 0)
+	{
+		voice = &audio_voices[0];
+		if (cmd == MUS_OFF)
+		{
+			voice->cmd = 0;
+			return;
+		}
+		voice->loop = 1;
+	}
+	else
+	{
+		/* Use a free voice, or steal the oldest one */
+		voice = &audio_voices[1];
+		for (n = 1; n < AUDIO_VOICES; n++)
+		{
+			if (audio_voices[n].cmd == 0)
+			{
+				voice = &audio_voices[n];
+				break;
+			}
+			if (audio_voices[n].started < voice->started)
+				voice = &audio_voices[n];
+		}
+		if (n == AUDIO_VOICES)
+			audio_voice_steals++;
+		voice->loop = 0;
+		voice->left = AUDIO_EFFECT_SAMPLES;
+	}
+
+	/* Spread the codes over about 110-1870Hz */
+	voice->cmd = cmd;
+	voice->phase = 0;
+	voice->step = ((110 + (cmd & 0xFF) * 7) << 16) / AUDIO_RATE;
+	voice->started = now;
+}
+
+
+/** Take all new commands off the command ring.  This is the only
+consumer. */
+static void audio_read_commands (unsigned long now)
+{
+	unsigned int tail = audio_queue.tail;
+	unsigned int latency;
+
+	while (tail != __atomic_load_n (&audio_queue.head, __ATOMIC_ACQUIRE))
+	{
+		struct audio_command *ac = &audio_queue.elems[tail];
+
+		audio_voice_start (ac->cmd, now);
+		latency = now - ac->time + audio_ring_count / (AUDIO_RATE / 1000);
+		audio_latency_total += latency;
+		if (latency > audio_latency_max)
+			audio_latency_max = latency;
+		audio_commands++;
+
+		tail = (tail + 1) % AUDIO_QUEUE_LEN;
+		__atomic_store_n (&audio_queue.tail, tail, __ATOMIC_RELEASE);
+	}
+}
+
+
+/** Mix one period of all active voices into the output ring */
+static void audio_mix (void)
+{
+	int mix[AUDIO_PERIOD_SAMPLES];
+	unsigned int n, s, pos;
+
+	memset (mix, 0, sizeof (mix));
+	for (n = 0; n < AUDIO_VOICES; n++)
+	{
+		struct audio_voice *voice = &audio_voices[n];
+		if (voice->cmd == 0)
+			continue;
+
+		for (s = 0; s < AUDIO_PERIOD_SAMPLES; s++)
+		{
+			int level = AUDIO_AMPLITUDE;
+			if (!voice->loop)
+			{
+				if (voice->left == 0)
+				{
+					voice->cmd = 0;
+					break;
+				}
+				level = level * voice->left / AUDIO_EFFECT_SAMPLES;
+				voice->left--;
+			}
+			mix[s] += (voice->phase & 0x8000) ? level : -level;
+			voice->phase += voice->step;
+		}
+	}
+
+	pos = (audio_ring_head + audio_ring_count) % AUDIO_RING_SAMPLES;
+	for (s = 0; s < AUDIO_PERIOD_SAMPLES; s++)
+	{
+		if (mix[s] > 32767)
+			mix[s] = 32767;
+		else if (mix[s] < -32768)
+			mix[s] = -32768;
+		audio_ring[pos] = mix[s];
+		pos = (pos + 1) % AUDIO_RING_SAMPLES;
+	}
+	audio_ring_count += AUDIO_PERIOD_SAMPLES;
+}
+
+
+/** Pass the oldest COUNT samples from the output ring to the sink */
+static void audio_drain (unsigned int count)
+{
+	while (count > 0 && audio_ring_count > 0)
+	{
+		unsigned int chunk = AUDIO_RING_SAMPLES - audio_ring_head;
+		if (chunk > audio_ring_count)
+			chunk = audio_ring_count;
+		if (chunk > count)
+			chunk = count;
+
+		fwrite (&audio_ring[audio_ring_head], sizeof (S16), chunk, audio_out);
+		audio_out_samples += chunk;
+		audio_ring_head = (audio_ring_head + chunk) % AUDIO_RING_SAMPLES;
+		audio_ring_count -= chunk;
+		count -= chunk;
+	}
+}
+
+
+static void audio_periodic (void *data)
+{
+	if (!audio_out)
+		return;
+	audio_read_commands (realtime_read ());
+	audio_mix ();
+	audio_drain (AUDIO_PERIOD_SAMPLES);
+}
+
+
+static void audio_put_u32 (unsigned long n)
+{
+	fputc (n, audio_out);
+	fputc (n >> 8, audio_out);
+	fputc (n >> 16, audio_out);
+	fputc (n >> 24, audio_out);
+}
+
+
+/** Write a WAV header for SAMPLES samples of 16-bit mono */
+static void audio_wav_header (unsigned long samples)
+{
+	fwrite ("RIFF", 4, 1, audio_out);
+	audio_put_u32 (36 + samples * 2);
+	fwrite ("WAVEfmt ", 8, 1, audio_out);
+	audio_put_u32 (16);
+	audio_put_u32 (1 + (1 << 16)); /* PCM, 1 channel */
+	audio_put_u32 (AUDIO_RATE);
+	audio_put_u32 (AUDIO_RATE * 2);
+	audio_put_u32 (2 + (16 << 16)); /* block size, bits per sample */
+	fwrite ("data", 4, 1, audio_out);
+	audio_put_u32 (samples * 2);
+}
+
+
+/** Start sending audio to a file, WAV file or command. */
+void audio_open (const char *filename)
+{
+	const char *ext = strrchr (filename, '.');
+	unsigned int prefill;
+
+	audio_out_pipe = (filename[0] == '|');
+	audio_out_wav = !audio_out_pipe && ext && !strcmp (ext, ".wav");
+	if (audio_out_pipe)
+		audio_out = popen (filename + 1, "w");
+	else
+		audio_out = fopen (filename, "wb");
+	if (!audio_out)
+	{
+		simlog (SLC_DEBUG, "audio: can't open '%s'", filename);
+		return;
+	}
+
+	audio_out_samples = 0;
+	if (audio_out_wav)
+		audio_wav_header (0);
+
+	/* Fill the output ring with silence up to the buffer size */
+	if (audio_buffer_ms > 500)
+		audio_buffer_ms = 500;
+	prefill = AUDIO_RATE * audio_buffer_ms / 1000;
+	memset (audio_ring, 0, sizeof (audio_ring));
+	audio_ring_head = 0;
+	audio_ring_count = prefill;
+
+	sim_time_register (AUDIO_PERIOD, TRUE, audio_periodic, NULL);
+	simlog (SLC_DEBUG, "audio: writing to '%s'", filename);
+}
+
+
+/** Flush the output and close the sink, reporting the latencies. */
+void audio_close (void)
+{
+	if (!audio_out)
+		return;
+
+	audio_drain (audio_ring_count);
+	if (audio_out_wav)
+	{
+		fseek (audio_out, 0, SEEK_SET);
+		audio_wav_header (audio_out_samples);
+	}
+	if (audio_out_pipe)
+		pclose (audio_out);
+	else
+		fclose (audio_out);
+	audio_out = NULL;
+
+	simlog (SLC_DEBUG, "audio: %d commands, latency avg %lums max %dms",
+		audio_commands,
+		audio_commands ? audio_latency_total / audio_commands : 0,
+		audio_latency_max);
+	if (audio_queue_drops || audio_voice_steals)
+		simlog (SLC_DEBUG, "audio: %d commands dropped, %d voices stolen",
+			audio_queue_drops, audio_voice_steals);
+}
+
+
+void audio_init (void)
+{
+	conf_add ("audio.buffer", &audio_buffer_ms);
+	conf_add ("audio.commands", &audio_commands);
+	conf_add ("audio.latency", &audio_latency_max);
+	conf_add ("audio.drops", &audio_queue_drops);
+}
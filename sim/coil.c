@@ -314,7 +314,12 @@ static void sim_coil_update (struct sim_coil_state *c)
 			m->at_max = 1;
 			simlog (SLC_DEBUG, "Coil %d on", m - coil_states);
 			if (m->type->at_max)
+			{
+				/* Balls kicked by coils are not journalled inputs */
+				journal_suspend ();
 				m->type->at_max (c);
+				journal_resume ();
+			}
 		}
 	}
 	/* Else, if the IO is off and the coil has not reached its rest state,
@@ -20,25 +20,56 @@
 
 
 /*	This module manages configurations for the native mode simulator.
-	A configuration file can contain <var>=<value> definitions. */
+	A configuration file can contain <var>=<value> definitions.
+
+	Each item is a typed variable (int, float or string) owned by some
+	simulator module, which registers it with one of the conf_add
+	functions.  The name is hashed once; conf_key returns a handle to
+	the item that can be used for any number of later reads and writes
+	without looking the name up again.  Callbacks can be attached to an
+	item to be notified when its value changes. */
 
 #include <freewpc.h>
 #include <simulation.h>
+#include <ctype.h>
 
 #define HASH_SIZE 101
 #define MAX_CONF_STACK 64
 
+struct conf_watch
+{
+	conf_watch_t fn;
+	void *data;
+	struct conf_watch *next;
+};
+
 struct conf_item
 {
 	const char *name;
 	unsigned int hash;
-	int *valp;
+	enum conf_type type;
+	union {
+		int *ip;
+		double *fp;
+		char **sp;
+	} valp;
+
+	/* For strings, nonzero if the current value was allocated here */
+	bool owned;
+
+	struct conf_watch *watches;
 	struct conf_item *chain;
+
+	/* All items, in the order that they were added */
+	struct conf_item *next;
 };
 
 
 struct conf_item *conf_table[HASH_SIZE] = { NULL, };
 
+struct conf_item *conf_list = NULL;
+struct conf_item **conf_list_tail = &conf_list;
+
 
 int conf_stack[MAX_CONF_STACK];
 int *conf_stack_ptr = conf_stack;
@@ -61,23 +92,201 @@ static struct conf_item *conf_find (const char *name)
 	struct conf_item *cf = conf_table[hash % HASH_SIZE];
 	while (cf != NULL)
 	{
-		if (cf->hash == hash)
+		if (cf->hash == hash && !strcmp (cf->name, name))
 			return cf;
 		cf = cf->chain;
 	}
 	return NULL;
 }
 
-/*	Define a new, valid configuration item.
-	This must be called _before_ the config data is loaded from the file/script. */
-void conf_add (const char *name, int *valp)
+static struct conf_item *conf_add_type (const char *name, enum conf_type type)
 {
 	struct conf_item *cf = malloc (sizeof (struct conf_item));
-	cf->name = name;
+	cf->name = strdup (name);
 	cf->hash = conf_hash (name);
-	cf->valp = valp;
+	cf->type = type;
+	cf->owned = FALSE;
+	cf->watches = NULL;
 	cf->chain = conf_table[cf->hash % HASH_SIZE];
 	conf_table[cf->hash % HASH_SIZE] = cf;
+	cf->next = NULL;
+	*conf_list_tail = cf;
+	conf_list_tail = &cf->next;
+	return cf;
+}
+
+/*	Define a new, valid configuration item.
+	This must be called _before_ the config data is loaded from the file/script.
+	The name is copied, so it need not remain valid afterwards. */
+void conf_add (const char *name, int *valp)
+{
+	conf_add_type (name, CONF_INT)->valp.ip = valp;
+}
+
+void conf_add_float (const char *name, double *valp)
+{
+	conf_add_type (name, CONF_FLOAT)->valp.fp = valp;
+}
+
+/*	For a string item, *VALP may initially point to a constant string;
+	it is not freed when the value changes. */
+void conf_add_string (const char *name, char **valp)
+{
+	conf_add_type (name, CONF_STRING)->valp.sp = valp;
+}
+
+
+/*	Return a handle to a configuration item, or NULL if it has not
+	been defined.  The handle remains valid for the rest of the run. */
+conf_key_t conf_key (const char *name)
+{
+	return conf_find (name);
+}
+
+const char *conf_key_name (conf_key_t cf)
+{
+	return cf->name;
+}
+
+enum conf_type conf_key_type (conf_key_t cf)
+{
+	return cf->type;
+}
+
+
+/*	Call a function whenever the value of an item changes. */
+void conf_watch (conf_key_t cf, conf_watch_t fn, void *data)
+{
+	struct conf_watch *w = malloc (sizeof (struct conf_watch));
+	w->fn = fn;
+	w->data = data;
+	w->next = cf->watches;
+	cf->watches = w;
+}
+
+static void conf_notify (struct conf_item *cf)
+{
+	struct conf_watch *w;
+	for (w = cf->watches; w; w = w->next)
+		w->fn (cf, w->data);
+}
+
+
+/*	Read an item as an integer, whatever its type. */
+int conf_get (conf_key_t cf)
+{
+	switch (cf->type)
+	{
+		case CONF_INT:
+		default:
+			return *cf->valp.ip;
+		case CONF_FLOAT:
+			return (int)*cf->valp.fp;
+		case CONF_STRING:
+			return *cf->valp.sp ? strtol (*cf->valp.sp, NULL, 0) : 0;
+	}
+}
+
+double conf_get_float (conf_key_t cf)
+{
+	if (cf->type == CONF_FLOAT)
+		return *cf->valp.fp;
+	else if (cf->type == CONF_STRING)
+		return *cf->valp.sp ? strtod (*cf->valp.sp, NULL) : 0.0;
+	return conf_get (cf);
+}
+
+/*	Format an item's value as a string.  The result is in a static
+	buffer, except for string items where the value itself is returned. */
+const char *conf_get_string (conf_key_t cf)
+{
+	static char buf[32];
+
+	switch (cf->type)
+	{
+		case CONF_INT:
+		default:
+			snprintf (buf, sizeof (buf), "%d", *cf->valp.ip);
+			return buf;
+		case CONF_FLOAT:
+			snprintf (buf, sizeof (buf), "%g", *cf->valp.fp);
+			return buf;
+		case CONF_STRING:
+			return *cf->valp.sp ? *cf->valp.sp : "";
+	}
+}
+
+
+/*	Write an item, converting from an integer if necessary. */
+void conf_set (conf_key_t cf, int val)
+{
+	char buf[16];
+
+	switch (cf->type)
+	{
+		case CONF_INT:
+		default:
+			if (*cf->valp.ip == val)
+				return;
+			*cf->valp.ip = val;
+			break;
+		case CONF_FLOAT:
+			conf_set_float (cf, val);
+			return;
+		case CONF_STRING:
+			snprintf (buf, sizeof (buf), "%d", val);
+			conf_set_string (cf, buf);
+			return;
+	}
+	conf_notify (cf);
+}
+
+void conf_set_float (conf_key_t cf, double val)
+{
+	char buf[32];
+
+	switch (cf->type)
+	{
+		case CONF_INT:
+		default:
+			conf_set (cf, (int)val);
+			return;
+		case CONF_FLOAT:
+			if (*cf->valp.fp == val)
+				return;
+			*cf->valp.fp = val;
+			break;
+		case CONF_STRING:
+			snprintf (buf, sizeof (buf), "%g", val);
+			conf_set_string (cf, buf);
+			return;
+	}
+	conf_notify (cf);
+}
+
+/*	Write an item from its text form, parsing it according to the
+	item's type. */
+void conf_set_string (conf_key_t cf, const char *val)
+{
+	switch (cf->type)
+	{
+		case CONF_INT:
+		default:
+			conf_set (cf, strtol (val, NULL, 0));
+			return;
+		case CONF_FLOAT:
+			conf_set_float (cf, strtod (val, NULL));
+			return;
+		case CONF_STRING:
+			if (*cf->valp.sp && !strcmp (*cf->valp.sp, val))
+				return;
+			if (cf->owned)
+				free (*cf->valp.sp);
+			*cf->valp.sp = strdup (val);
+			cf->owned = TRUE;
+			break;
+	}
+	conf_notify (cf);
 }
 
 
@@ -87,10 +296,16 @@ int conf_read (const char *name)
 {
 	struct conf_item *cf = conf_find (name);
 	if (cf)
-		return *(cf->valp);
+		return conf_get (cf);
 	return 0;
 }
 
+/*	Return true if a configuration item has been defined. */
+bool conf_defined (const char *name)
+{
+	return conf_find (name) != NULL;
+}
+
 /*	Modify the current value of a configuration item, by name.
 	If it has not been defined by the game program via 'conf_add',
 	this indicates a programmer error. */
@@ -98,14 +313,96 @@ void conf_write (const char *name, int val)
 {
 	struct conf_item *cf = conf_find (name);
 	if (cf)
-		*(cf->valp) = val;
+		conf_set (cf, val);
 	else
 		simlog (SLC_DEBUG, "No such conf item '%s'\n", name);
 }
 
 
+/*	Load a configuration file of <var>=<value> lines.  Blank lines and
+	lines beginning with '#' are ignored.  Returns the number of items
+	set, or -1 if the file could not be read. */
+int conf_load (const char *filename)
+{
+	FILE *fp;
+	char buf[256];
+	char *name, *val, *end;
+	struct conf_item *cf;
+	int count = 0;
+
+	fp = fopen (filename, "r");
+	if (!fp)
+	{
+		simlog (SLC_DEBUG, "Can't open config '%s'", filename);
+		return -1;
+	}
+
+	while (fgets (buf, sizeof (buf), fp))
+	{
+		for (name = buf; isspace (*name); name++);
+		if (*name == '#' || *name == '\0')
+			continue;
+
+		val = strchr (name, '=');
+		if (!val)
+			continue;
+		for (end = val; end > name && isspace (end[-1]); end--);
+		*end = '\0';
+		for (val++; isspace (*val); val++);
+		for (end = val + strlen (val); end > val && isspace (end[-1]); end--);
+		*end = '\0';
+
+		cf = conf_find (name);
+		if (!cf)
+		{
+			simlog (SLC_DEBUG, "%s: no such conf item '%s'", filename, name);
+			continue;
+		}
+		conf_set_string (cf, val);
+		count++;
+	}
+
+	fclose (fp);
+	simlog (SLC_DEBUG, "Loaded %d items from '%s'", count, filename);
+	return count;
+}
+
+
+/*	Save every configuration item to a file, in a form that can be read
+	back with conf_load.  Returns the number of items written, or -1 on
+	error. */
+int conf_save (const char *filename)
+{
+	FILE *fp;
+	struct conf_item *cf;
+	int count = 0;
+
+	fp = fopen (filename, "w");
+	if (!fp)
+	{
+		simlog (SLC_DEBUG, "Can't write config '%s'", filename);
+		return -1;
+	}
+
+	fprintf (fp, "# Simulator configuration for %s\n", MACHINE_SHORTNAME);
+	for (cf = conf_list; cf; cf = cf->next)
+	{
+		fprintf (fp, "%s = %s\n", cf->name, conf_get_string (cf));
+		count++;
+	}
+
+	fclose (fp);
+	return count;
+}
+
+
 void conf_push (int val)
 {
+	if (conf_stack_ptr >= conf_stack + MAX_CONF_STACK - 1)
+	{
+		simlog (SLC_DEBUG, "conf stack overflow");
+		return;
+	}
 	conf_stack_ptr++;
 	*conf_stack_ptr = val;
 }
@@ -113,6 +410,8 @@ void conf_push (int val)
 
 void conf_pop (unsigned int count)
 {
+	if (count > conf_stack_ptr - conf_stack)
+		count = conf_stack_ptr - conf_stack;
 	conf_stack_ptr -= count;
 }
 
@@ -0,0 +1,281 @@
+/*
+ * Copyright 2011 by Brian Dominy <brian@oddchange.com>
+ *
+ * This file is part of FreeWPC.
+ *
+ * FreeWPC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeWPC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeWPC; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <freewpc.h>
+#include <simulation.h>
+#include <ctype.h>
+
+/* This module loads a machine's graph file, which describes how balls
+	travel around the playfield, and uses it to choose where balls go.
+
+	The graph file is named sim/<machine>.graph.  Each line is one of:
+
+		<from>, <delay>[~<spread>], <to>[, <weight>]
+		<from>, hold <delay>[~<spread>]
+
+	The first form adds a path from one node to another.  When a node
+	has several paths, a kick picks one at random in proportion to the
+	weights (default 1).  The travel time is <delay> milliseconds, plus
+	or minus up to <spread> milliseconds.
+
+	The second form says how long a ball rests at a node before it is
+	kicked automatically, when the 'pf.autoplay' variable is set.  Giving
+	the playfield a hold time makes the simulator take shots on its own.
+
+	Nodes are named the same way as in the machine description:
+	SW_<switch>, DEVNO_<device>, or PLAYFIELD and DRAIN for the open
+	playfield and the drain. */
+
+extern device_properties_t device_properties_table[];
+
+/** The total number of shots taken using weighted paths */
+int graph_shot_count;
+
+
+/**
+ * Compare a name from the graph file against a switch or device name
+ * from the machine description, ignoring case and treating any
+ * punctuation in the machine name as an underscore.
+ */
+static bool graph_name_match (const char *id, const char *name)
+{
+	if (!name)
+		return FALSE;
+	while (*name)
+	{
+		if (isalnum (*name))
+		{
+			if (toupper (*name) != *id)
+				return FALSE;
+			id++;
+			name++;
+		}
+		else
+		{
+			if (*id != '_')
+				return FALSE;
+			id++;
+			while (*name && !isalnum (*name))
+				name++;
+		}
+	}
+	return *id == '\0';
+}
+
+
+/**
+ * Return the node named in the graph file.
+ */
+static struct ball_node *graph_node_find (const char *id)
+{
+	unsigned int n;
+
+	if (!strcmp (id, "PLAYFIELD"))
+		return &open_node;
+#ifdef drain_node
+	if (!strcmp (id, "DRAIN"))
+		return &drain_node;
+#endif
+	if (!strncmp (id, "SW_", 3))
+	{
+		for (n = 0; n < NUM_SWITCHES; n++)
+			if (graph_name_match (id+3, names_of_switches[n]))
+				return &switch_nodes[n];
+	}
+	else if (!strncmp (id, "DEVNO_", 6))
+	{
+		for (n = 0; n < NUM_DEVICES; n++)
+			if (graph_name_match (id+6, device_properties_table[n].name))
+				return &device_nodes[n];
+	}
+	return NULL;
+}
+
+
+/**
+ * Parse a time of the form <delay>[~<spread>].
+ */
+static void graph_parse_time (const char *s, unsigned int *delay,
+	unsigned int *spread)
+{
+	char *end;
+
+	*delay = strtoul (s, &end, 0);
+	*spread = 0;
+	if (*end == '~')
+		*spread = strtoul (end+1, NULL, 0);
+	if (*spread > *delay)
+		*spread = *delay;
+}
+
+
+/**
+ * Return the next comma-separated field, with whitespace trimmed.
+ */
+static char *graph_field (char *s)
+{
+	char *end;
+
+	s = strtok (s, ",");
+	if (!s)
+		return NULL;
+	while (isspace (*s))
+		s++;
+	end = s + strlen (s);
+	while (end > s && isspace (end[-1]))
+		*--end = '\0';
+	return s;
+}
+
+
+/**
+ * Load the graph file for this machine.
+ */
+void graph_load (const char *filename)
+{
+	FILE *in;
+	char buf[256];
+	unsigned int line = 0;
+
+	srandom (sim_random_seed);
+
+	in = fopen (filename, "r");
+	if (!in)
+		return;
+	simlog (SLC_DEBUG, "Reading graph from '%s'", filename);
+
+	while (fgets (buf, sizeof (buf), in))
+	{
+		char *from_id, *time, *to_id, *weight;
+		struct ball_node *from, *to;
+		struct ball_path *path;
+
+		line++;
+		if ((from_id = strchr (buf, '#')) != NULL)
+			*from_id = '\0';
+
+		from_id = graph_field (buf);
+		if (!from_id || *from_id == '\0')
+			continue;
+		time = graph_field (NULL);
+		to_id = graph_field (NULL);
+		weight = graph_field (NULL);
+
+		from = graph_node_find (from_id);
+		if (!from || !time)
+		{
+			simlog (SLC_DEBUG, "%s:%d: bad node '%s'", filename, line, from_id);
+			continue;
+		}
+
+		/* A hold time for autoplay */
+		if (!strncmp (time, "hold", 4))
+		{
+			graph_parse_time (time + 4, &from->hold, &from->hold_spread);
+			continue;
+		}
+
+		/* Otherwise, a weighted path */
+		to = to_id ? graph_node_find (to_id) : NULL;
+		if (!to)
+		{
+			simlog (SLC_DEBUG, "%s:%d: bad node '%s'", filename, line,
+				to_id ? to_id : "");
+			continue;
+		}
+
+		path = malloc (sizeof (struct ball_path));
+		path->dst = to;
+		graph_parse_time (time, &path->delay, &path->spread);
+		path->weight = weight ? strtoul (weight, NULL, 0) : 1;
+		path->count = 0;
+		path->next = from->paths;
+		from->paths = path;
+		from->path_weight += path->weight;
+	}
+
+	fclose (in);
+}
+
+
+/**
+ * Choose one of the weighted paths out of a node.
+ * Returns NULL if the node does not have any.
+ */
+struct ball_path *graph_choose (struct ball_node *node)
+{
+	struct ball_path *path;
+	unsigned int r;
+
+	if (node->path_weight == 0)
+		return NULL;
+
+	r = random () % node->path_weight;
+	for (path = node->paths; path; path = path->next)
+	{
+		if (r < path->weight)
+		{
+			path->count++;
+			graph_shot_count++;
+			return path;
+		}
+		r -= path->weight;
+	}
+	return NULL;
+}
+
+
+/**
+ * Return a random time between DELAY-SPREAD and DELAY+SPREAD.
+ * The sum of two uniform values is used, so times near DELAY are
+ * the most likely.
+ */
+unsigned int graph_sample (unsigned int delay, unsigned int spread)
+{
+	if (spread == 0)
+		return delay;
+	return delay - spread + (random () % (spread + 1)) + (random () % (spread + 1));
+}
+
+
+/**
+ * Print how many times each path was taken.
+ */
+void graph_report (void)
+{
+	unsigned int n;
+	struct ball_path *path;
+
+	if (graph_shot_count == 0)
+		return;
+
+	simlog (SLC_DEBUG, "%d weighted shots taken", graph_shot_count);
+	for (n = 0; n < NUM_SWITCHES; n++)
+		for (path = switch_nodes[n].paths; path; path = path->next)
+			simlog (SLC_DEBUG, "  %s -> %s: %lu", switch_nodes[n].name,
+				path->dst->name, path->count);
+	for (n = 0; n < NUM_DEVICES; n++)
+		for (path = device_nodes[n].paths; path; path = path->next)
+			simlog (SLC_DEBUG, "  %s -> %s: %lu", device_nodes[n].name,
+				path->dst->name, path->count);
+	for (path = open_node.paths; path; path = path->next)
+		simlog (SLC_DEBUG, "  %s -> %s: %lu", open_node.name,
+			path->dst->name, path->count);
+}
@@ -0,0 +1,349 @@
+/*
+ * Copyright 2011 by Brian Dominy <brian@oddchange.com>
+ *
+ * This file is part of FreeWPC.
+ *
+ * FreeWPC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeWPC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeWPC; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include <freewpc.h>
+#include <simulation.h>
+#include <hwsim/ball.h>
+
+/* This module records the inputs to a simulation session -- switch
+	changes and ball movements made by the user, a script, or autoplay --
+	into a compact binary journal, and can later feed the same inputs back
+	at the same simulated times.
+
+	Changes that are only consequences of other events, such as a switch
+	closing because a ball arrived at its node, or a ball kicked out by a
+	coil, are not recorded; they happen again on their own during replay.
+	Code that causes such changes brackets them with journal_suspend and
+	journal_resume.  Autoplay shots are treated the same way: they follow
+	from the random seed, so only changes to 'pf.autoplay' are recorded.
+
+	The file starts with a 4-byte magic value and the random seed, so
+	that weighted shots come out the same way.  Each record that follows
+	is the time since the previous record in milliseconds, as a
+	variable-length number (7 bits per byte, high bit means more), then a
+	type byte and its arguments. */
+
+#define JOURNAL_MAGIC "FWJ1"
+
+enum journal_record_type
+{
+	J_END,
+	J_SW_TOGGLE,  /* switch */
+	J_SW_ON,      /* switch */
+	J_SW_OFF,     /* switch */
+	J_MOVE,       /* source node, destination node, delay */
+	J_AUTOPLAY,   /* new value */
+};
+
+/* Nodes are written as a single byte: switch nodes by switch number,
+	device nodes by device number plus J_NODE_DEVICE, and the open
+	playfield as J_NODE_OPEN. */
+#define J_NODE_DEVICE 0xC0
+#define J_NODE_OPEN 0xFF
+
+extern struct ball_node open_node;
+
+/** The file being written, if recording */
+static FILE *journal_out;
+
+/** The file being read, if replaying */
+static FILE *journal_in;
+
+/** The time of the previous record written or read */
+static unsigned long journal_last_time;
+
+/** Nonzero while inside code whose effects should not be recorded */
+static int journal_suspended;
+
+/** The number of records written or replayed */
+int journal_events;
+
+
+static void journal_put_number (unsigned long n)
+{
+	while (n >= 0x80)
+	{
+		fputc ((n & 0x7F) | 0x80, journal_out);
+		n >>= 7;
+	}
+	fputc (n, journal_out);
+}
+
+
+static int journal_get_number (unsigned long *np)
+{
+	unsigned long n = 0;
+	unsigned int shift = 0;
+	int c;
+
+	do {
+		if ((c = fgetc (journal_in)) == EOF)
+			return EOF;
+		n |= (unsigned long)(c & 0x7F) << shift;
+		shift += 7;
+	} while (c & 0x80);
+	*np = n;
+	return 0;
+}
+
+
+static int journal_node_id (struct ball_node *node)
+{
+	if (node == &open_node)
+		return J_NODE_OPEN;
+	if (node >= switch_nodes && node < switch_nodes + NUM_SWITCHES)
+		return node - switch_nodes;
+	if (node >= device_nodes && node < device_nodes + NUM_DEVICES)
+		return J_NODE_DEVICE + (node - device_nodes);
+	return -1;
+}
+
+
+static struct ball_node *journal_node (int id)
+{
+	if (id == J_NODE_OPEN)
+		return &open_node;
+	if (id < NUM_SWITCHES)
+		return &switch_nodes[id];
+	if (id >= J_NODE_DEVICE && id < J_NODE_DEVICE + NUM_DEVICES)
+		return &device_nodes[id - J_NODE_DEVICE];
+	return NULL;
+}
+
+
+/** Begin writing a record of the given type, if recording. */
+static bool journal_begin (enum journal_record_type type)
+{
+	unsigned long now;
+
+	if (!journal_out || journal_suspended)
+		return FALSE;
+
+	now = realtime_read ();
+	journal_put_number (now - journal_last_time);
+	journal_last_time = now;
+	fputc (type, journal_out);
+	journal_events++;
+	return TRUE;
+}
+
+
+void journal_suspend (void)
+{
+	journal_suspended++;
+}
+
+void journal_resume (void)
+{
+	journal_suspended--;
+}
+
+
+void journal_switch_toggle (int sw)
+{
+	if (journal_begin (J_SW_TOGGLE))
+		fputc (sw, journal_out);
+}
+
+void journal_switch_set (int sw, int on)
+{
+	if (journal_begin (on ? J_SW_ON : J_SW_OFF))
+		fputc (sw, journal_out);
+}
+
+void journal_node_move (struct ball_node *dst, struct ball_node *src,
+	unsigned int delay)
+{
+	int src_id, dst_id;
+
+	if (!journal_out || journal_suspended)
+		return;
+
+	src_id = journal_node_id (src);
+	dst_id = journal_node_id (dst);
+	if (src_id < 0 || dst_id < 0)
+	{
+		simlog (SLC_DEBUG, "journal: can't record move %s -> %s", src->name, dst->name);
+		return;
+	}
+
+	journal_begin (J_MOVE);
+	fputc (src_id, journal_out);
+	fputc (dst_id, journal_out);
+	journal_put_number (delay);
+}
+
+
+static void journal_autoplay_changed (conf_key_t key, void *data)
+{
+	if (journal_begin (J_AUTOPLAY))
+		fputc (conf_get (key), journal_out);
+}
+
+
+/** Start recording inputs to a file. */
+void journal_record (const char *filename)
+{
+	journal_stop ();
+	journal_out = fopen (filename, "wb");
+	if (!journal_out)
+	{
+		simlog (SLC_DEBUG, "journal: can't write '%s'", filename);
+		return;
+	}
+
+	fwrite (JOURNAL_MAGIC, 4, 1, journal_out);
+	journal_last_time = realtime_read ();
+	journal_put_number (sim_random_seed);
+	srandom (sim_random_seed);
+	journal_events = 0;
+	journal_autoplay_changed (conf_key ("pf.autoplay"), NULL);
+	simlog (SLC_DEBUG, "journal: recording to '%s'", filename);
+}
+
+
+static void journal_replay_next (void *data);
+
+/** Read the time of the next record and schedule it. */
+static void journal_replay_schedule (void)
+{
+	unsigned long delta;
+
+	if (journal_get_number (&delta) == EOF)
+	{
+		journal_stop ();
+		return;
+	}
+	journal_last_time += delta;
+	if (journal_last_time <= realtime_read ())
+		journal_replay_next (NULL);
+	else
+		sim_time_register (journal_last_time - realtime_read (), FALSE,
+			journal_replay_next, NULL);
+}
+
+
+/** Apply the next record when its time arrives, and schedule the one
+after it. */
+static void journal_replay_next (void *data)
+{
+	int type, sw, src, dst;
+	unsigned long delay;
+
+	if (!journal_in)
+		return;
+
+	type = fgetc (journal_in);
+	switch (type)
+	{
+		case J_SW_TOGGLE:
+			sim_switch_toggle (fgetc (journal_in));
+			break;
+
+		case J_SW_ON:
+		case J_SW_OFF:
+			sw = fgetc (journal_in);
+			sim_switch_set (sw, type == J_SW_ON);
+			break;
+
+		case J_MOVE:
+			src = fgetc (journal_in);
+			dst = fgetc (journal_in);
+			journal_get_number (&delay);
+			if (!node_move_delay (journal_node (dst), journal_node (src), delay))
+				simlog (SLC_DEBUG, "journal: replayed move failed");
+			break;
+
+		case J_AUTOPLAY:
+			conf_set (conf_key ("pf.autoplay"), fgetc (journal_in));
+			break;
+
+		case J_END:
+		case EOF:
+		default:
+			journal_stop ();
+			return;
+	}
+
+	journal_events++;
+	journal_replay_schedule ();
+}
+
+
+/** Start feeding inputs from a journal. */
+void journal_replay (const char *filename)
+{
+	char magic[4];
+	unsigned long seed;
+
+	journal_stop ();
+	journal_in = fopen (filename, "rb");
+	if (!journal_in)
+	{
+		simlog (SLC_DEBUG, "journal: can't read '%s'", filename);
+		return;
+	}
+
+	if (fread (magic, 4, 1, journal_in) != 1
+		|| memcmp (magic, JOURNAL_MAGIC, 4)
+		|| journal_get_number (&seed) == EOF)
+	{
+		simlog (SLC_DEBUG, "journal: '%s' is not a journal", filename);
+		fclose (journal_in);
+		journal_in = NULL;
+		return;
+	}
+
+	sim_random_seed = seed;
+	srandom (seed);
+	journal_last_time = realtime_read ();
+	journal_events = 0;
+	simlog (SLC_DEBUG, "journal: replaying '%s'", filename);
+	journal_replay_schedule ();
+}
+
+
+/** Stop recording or replaying. */
+void journal_stop (void)
+{
+	if (journal_out)
+	{
+		journal_put_number (realtime_read () - journal_last_time);
+		fputc (J_END, journal_out);
+		fclose (journal_out);
+		journal_out = NULL;
+		simlog (SLC_DEBUG, "journal: %d events recorded", journal_events);
+	}
+	if (journal_in)
+	{
+		fclose (journal_in);
+		journal_in = NULL;
+		simlog (SLC_DEBUG, "journal: %d events replayed", journal_events);
+	}
+}
+
+
+void journal_init (void)
+{
+	conf_key_t key = conf_key ("pf.autoplay");
+	if (key)
+		conf_watch (key, journal_autoplay_changed, NULL);
+	conf_add ("journal.events", &journal_events);
+}
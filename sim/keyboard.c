@@ -258,7 +258,7 @@ static void sim_interface_thread (void)
 				break;
 
 			case 'q':
-				node_kick (&open_node);
+				node_move (open_node.next, &open_node);
 				break;
 
 #ifdef CONFIG_DEBUG_INPUT
@@ -70,6 +70,14 @@ int exec_late_flag = 0;
 
 int crash_on_error = 0;
 
+const char *journal_record_file = NULL;
+
+const char *journal_replay_file = NULL;
+
+/** The seed for random choices made by the simulator, so that
+runs can be repeated exactly */
+int sim_random_seed = 1;
+
 
 /** Prints log messages, requested status, etc. to the console.
  * This is the only function that should use printf.
@@ -117,6 +125,25 @@ void puts_sim (const char *s)
 __noreturn__ void sim_exit (U8 error_code)
 {
 	simlog (SLC_DEBUG, "Shutting down simulation.");
+	journal_stop ();
+	audio_close ();
+	graph_report ();
+#ifdef CONFIG_RTT_PROFILE
+	rtt_profile_write (RTT_PROFILE_FILE);
+#endif
+#ifdef CONFIG_CALLSET_PROFILE
+	callset_profile_write (CALLSET_PROFILE_FILE);
+#endif
+#ifdef CONFIG_SWITCH_TRACE
+	switch_trace_dump ();
+#endif
+#ifdef CONFIG_LOG
+	log_write (LOG_FILE);
+#endif
+#ifdef CONFIG_RTT_RATES
+	rtt_rate_report (&tick_table);
+	rtt_rate_report (&native_rtt_table);
+#endif
 	protected_memory_save ();
 	ui_exit ();
 	if (crash_on_error && error_code)
@@ -152,6 +179,16 @@ void sim_init (void)
 	 * it will fill the trough, based on its actual size.  You
 	 * can use the --balls option to override this. */
 	node_init ();
+
+	/* Start recording or replaying inputs, if asked */
+	if (journal_replay_file)
+		journal_replay (journal_replay_file);
+	else if (journal_record_file)
+		journal_record (journal_record_file);
+
+	/* Start playing sound commands, if asked */
+	if (audio_file)
+		audio_open (audio_file);
 }
 
 
@@ -177,6 +214,9 @@ int main (int argc, char *argv[])
 			printf ("-o <file>           Log debug messages to file (default : stdout)\n");
 			printf ("--debuginit         Wait for GDB attach during init (default: no)\n");
 			printf ("--exec <file>       Read script commands from file\n");
+			printf ("--record <file>     Record switch and ball inputs to a journal\n");
+			printf ("--replay <file>     Replay inputs from a journal\n");
+			printf ("--audio <file>      Play sound commands to a file, .wav file or |command\n");
 			exit (0);
 		}
 		else if (!strcmp (arg, "-f"))
@@ -200,6 +240,18 @@ int main (int argc, char *argv[])
 		{
 			exec_file = argv[argn++];
 		}
+		else if (!strcmp (arg, "--record"))
+		{
+			journal_record_file = argv[argn++];
+		}
+		else if (!strcmp (arg, "--replay"))
+		{
+			journal_replay_file = argv[argn++];
+		}
+		else if (!strcmp (arg, "--audio"))
+		{
+			audio_file = argv[argn++];
+		}
 		else if (!strcmp (arg, "--late"))
 		{
 			exec_late_flag = 1;
@@ -302,6 +354,11 @@ int main (int argc, char *argv[])
 	/* Create more conf knobs */
 	conf_add ("balls", &sim_installed_balls);
 	conf_add ("sim.speed", &linux_irq_multiplier);
+	conf_add ("sim.seed", &sim_random_seed);
+	conf_add ("pf.autoplay", &sim_autoplay);
+	conf_add ("pf.shots", &graph_shot_count);
+	journal_init ();
+	audio_init ();
 
 	/* Execute default script file.  First, load any global
 	configuration in freewpc.conf.  Then, try to load a
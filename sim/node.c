@@ -34,6 +34,10 @@
 extern device_properties_t device_properties_table[];
 extern int sim_installed_balls;
 
+/* When nonzero, nodes that have a hold time kick balls on their own,
+   so that the simulation plays itself without keyboard input. */
+int sim_autoplay = 0;
+
 /* Every node has an associated type object, which allows you to
    customize how that node behaves when a ball is inserted or removed. */
 
@@ -129,7 +133,29 @@ bool node_full_p (struct ball_node *node)
 
 void node_kick_delayed (struct ball_node *node)
 {
+	journal_suspend ();
 	node_kick (node);
+	journal_resume ();
+}
+
+
+/* Kick a ball from a node on behalf of the player.  If it cannot move
+   yet, try again after another hold period. */
+static void node_autoplay_kick (struct ball_node *node)
+{
+	bool ok;
+
+	if (!sim_autoplay || node->count == 0)
+		return;
+
+	/* Autoplay shots follow from the random seed, so they are not
+	journalled */
+	journal_suspend ();
+	ok = node_kick (node);
+	journal_resume ();
+	if (!ok)
+		sim_time_register (graph_sample (node->hold, node->hold_spread), FALSE,
+			(time_handler_t)node_autoplay_kick, node);
 }
 
 
@@ -156,6 +182,10 @@ void node_insert (struct ball_node *node, struct ball *ball)
 	node->count++;
 	ball->node = node;
 	ball->pos = offset;
+
+	/* Anything that happens as a result of the ball arriving is
+	not an input, and is not journalled */
+	journal_suspend ();
 	if (node->type->insert)
 		node->type->insert (node, ball);
 	ui_update_ball_tracker (ball->index, node->name);
@@ -163,6 +193,10 @@ void node_insert (struct ball_node *node, struct ball *ball)
 
 	if (node->unlocked && !node_full_p (node->next))
 		sim_time_register (100, FALSE, (time_handler_t)node_kick_delayed, node);
+	else if (node->hold && sim_autoplay)
+		sim_time_register (graph_sample (node->hold, node->hold_spread), FALSE,
+			(time_handler_t)node_autoplay_kick, node);
+	journal_resume ();
 }
 
 
@@ -189,6 +223,7 @@ struct ball *node_remove (struct ball_node *node)
 	node->head++;
 	node->count--;
 	ball->node = NULL;
+	journal_suspend ();
 	if (node->type->remove)
 		node->type->remove (node, ball);
 	ui_update_ball_tracker (ball->index, "Free");
@@ -198,84 +233,116 @@ struct ball *node_remove (struct ball_node *node)
 	{
 		node_kick (node->prev);
 	}
+	journal_resume ();
 
 	return ball;
 }
 
 /* Insert a ball at a node after some number of milliseconds has expired.
    Until then the ball is not attached to any node.
-	Use this to simulate the distance between nodes.
-	The delay period must be given as a multiple of MIN_DELAY. */
-#define MIN_DELAY 100
+	Use this to simulate the distance between nodes.  A single timer is
+	scheduled for the exact arrival time. */
+static void node_insert_delay_expire (struct ball *ball)
+{
+	struct ball_node *dst = ball->node;
+	ball->timer = NULL;
+	ball->node = NULL;
+	node_insert (dst, ball);
+}
 
-static void node_insert_delay_update (struct ball *ball)
+void node_insert_delay (struct ball_node *dst, struct ball *ball,
+	unsigned int delay)
 {
-	ball->timer -= MIN_DELAY;
-	if (ball->timer <= 0)
+	node_insert_cancel (ball);
+	if (delay == 0)
 	{
-		struct ball_node *dst = ball->node;
-		ball->node = NULL;
 		node_insert (dst, ball);
+		return;
 	}
-	else
-		sim_time_register (MIN_DELAY, FALSE,
-			(time_handler_t)node_insert_delay_update, ball);
+	ball->node = dst;
+	ball->timer = sim_time_register (delay, FALSE,
+		(time_handler_t)node_insert_delay_expire, ball);
 }
 
-void node_insert_delay (struct ball_node *dst, struct ball *ball,
-	unsigned int delay)
+/* Cancel a delayed insert before the ball arrives.  The ball is left
+	in flight, not attached to any node.  Returns the node that it was
+	headed for, or NULL if it was not in flight. */
+struct ball_node *node_insert_cancel (struct ball *ball)
 {
-	ball->node = dst;
-	ball->timer = delay;
-	sim_time_register (MIN_DELAY, FALSE,
-		(time_handler_t)node_insert_delay_update, ball);
+	struct ball_node *dst;
+
+	if (!ball->timer)
+		return NULL;
+	sim_time_cancel (ball->timer);
+	ball->timer = NULL;
+	dst = ball->node;
+	ball->node = NULL;
+	return dst;
 }
 
 
-/* Move a ball from one location to another.  The two nodes do not
-	have to be connected via the default topology.  Use this directly when
-	needing to move balls around in an arbitrary manner, as if "by hand". */
-void node_move (struct ball_node *dst, struct ball_node *src)
+/* Move a ball from one location to another, taking DELAY milliseconds
+	to get there.  Returns TRUE if the ball was moved. */
+bool node_move_delay (struct ball_node *dst, struct ball_node *src,
+	unsigned int delay)
 {
 	struct ball *ball;
 
 	if (!dst || !src)
-		return;
+		return FALSE;
 
 	/* If there are already too many balls in the destination, then
 	don't allow the operation: it must remain where it is. */
 	if (node_full_p (dst))
 	{
 		simlog (SLC_DEBUG, "node_kick %s: destination %s is full", src->name, dst->name);
-		return;
+		return FALSE;
 	}
 
 	ball = node_remove (src);
 	if (!ball)
 	{
 		simlog (SLC_DEBUG, "node_kick: no balls in %s", src->name);
-		return;
+		return FALSE;
 	}
 
 	simlog (SLC_DEBUG, "node_kick: %s -> %s", src->name, dst->name);
+	journal_node_move (dst, src, delay);
 	/* If no delay is associated with a movement from the source, then
 	the move is instantaneous.  Otherwise, it will be performed later; in
 	the meantime the ball is not associated with any node. */
-	if (src->delay == 0)
+	if (delay == 0)
 		node_insert (dst, ball);
 	else
 	{
 		ui_update_ball_tracker (ball->index, src->name);
-		node_insert_delay (dst, ball, src->delay);
+		node_insert_delay (dst, ball, delay);
 	}
+	return TRUE;
+}
+
+
+/* Move a ball from one location to another.  The two nodes do not
+	have to be connected via the default topology.  Use this directly when
+	needing to move balls around in an arbitrary manner, as if "by hand". */
+bool node_move (struct ball_node *dst, struct ball_node *src)
+{
+	if (!src)
+		return FALSE;
+	return node_move_delay (dst, src, src->delay);
 }
 
 
 /* Move a ball to its default "next" location, using the topology graph.
-   This is the normal call to make when a ball should be allowed to move on its own. */
-void node_kick (struct ball_node *node)
+   This is the normal call to make when a ball should be allowed to move on its own.
+	If the node has weighted paths, one of them is chosen at random instead. */
+bool node_kick (struct ball_node *node)
 {
-	node_move (node->next, node);
+	struct ball_path *path = graph_choose (node);
+	if (path)
+		return node_move_delay (path->dst, node,
+			graph_sample (path->delay, path->spread));
+	return node_move (node->next, node);
 }
 
 
@@ -360,6 +427,9 @@ void node_init (void)
 	mach_node_init ();
 #endif
 
+	/* Load the weighted paths and hold times for autoplay */
+	graph_load ("sim/" MACHINE_SHORTNAME ".graph");
+
 #ifdef DEVNO_TROUGH
 	/* Create the pinballs and dump them into the trough.
 		Actually, we dump them onto the playfield and force them to drain.
@@ -368,13 +438,14 @@ void node_init (void)
 	for (i=0; i < sim_installed_balls; i++)
 	{
 		the_ball[i].node = NULL;
+		the_ball[i].timer = NULL;
 		strcpy (the_ball[i].name, "Ball X");
 		the_ball[i].name[5] = i + '0';
 		the_ball[i].index = i;
 		the_ball[i].flags = 0;
 
 		node_insert (&open_node, &the_ball[i]);
-		node_kick (&open_node);
+		node_move (open_node.next, &open_node);
 	}
 #endif
 }
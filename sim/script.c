@@ -18,10 +18,21 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#include <sys/types.h>
+#include <sys/stat.h>
 #include <freewpc.h>
 #include <simulation.h>
 #include <ctype.h>
 
+/*	This module implements the simulator's command language.
+
+	Scripts are compiled once into a list of instructions (struct
+	script_insn), and the instruction list is then executed.  All of the
+	string parsing -- command lookup, switch names, signal names --
+	is done during compilation, so loops and repeatedly included files
+	do not pay for it again.  Only '$' variable references are
+	deferred until the instruction actually runs. */
+
 const char *tlast = NULL;
 
 char tstringbuf[128];
@@ -30,6 +41,140 @@ char tstringbuf[128];
 #define tfirst(cmd)   strtok (cmd, delims)
 #define teq(t, s)     !strcmp (t, s)
 
+/** The number of buckets in the command hash table */
+#define SCRIPT_HASH_SIZE 31
+
+/** The maximum depth of nested loop/while/if blocks */
+#define MAX_SCRIPT_NESTING 16
+
+/** A value for a loop count meaning 'run forever' */
+#define SCRIPT_FOREVER -1
+
+/** How often a 'wait' command polls its condition, in ticks */
+#define SCRIPT_POLL_TICKS TIME_16MS
+
+enum script_opcode
+{
+	OP_NOP,
+	OP_CAPTURE_START,
+	OP_CAPTURE_STOP,
+	OP_CAPTURE_FILE,
+	OP_CAPTURE_ADD,
+	OP_CAPTURE_DEL,
+	OP_SET,
+	OP_SET_TEXT,
+	OP_ADD,
+	OP_VAR,
+	OP_PRINT,
+	OP_INCLUDE,
+	OP_SW,
+	OP_SWTOGGLE,
+	OP_KEY,
+	OP_PUSH,
+	OP_POP,
+	OP_SLEEP,
+	OP_WAIT,
+	OP_EXIT,
+	OP_LOOP,
+	OP_LOOP_END,
+	OP_IF,
+	OP_WHILE,
+	OP_JUMP,
+	OP_CONF_LOAD,
+	OP_CONF_SAVE,
+	OP_JOURNAL_RECORD,
+	OP_JOURNAL_REPLAY,
+	OP_JOURNAL_STOP,
+};
+
+/** The kinds of operands that an instruction can take.  Constants are
+resolved at compile time; variables and stack references are looked up
+each time the instruction executes.  A variable's name is resolved to a
+configuration handle the first time it is used. */
+enum script_value_type
+{
+	VAL_CONST,
+	VAL_VAR,
+	VAL_STACK,
+};
+
+struct script_value
+{
+	enum script_value_type type;
+	int value;
+	int scale;
+	const char *name;
+	conf_key_t key;
+};
+
+/** The kinds of conditions that can be tested by 'if', 'while' and
+'wait'. */
+enum script_cond_type
+{
+	COND_TRUE,
+	COND_VALUE,
+	COND_SWITCH,
+	COND_SIGNAL,
+	COND_CLOCK,
+};
+
+struct script_cond
+{
+	enum script_cond_type type;
+	bool negate;
+	uint32_t id;
+	struct script_value value;
+};
+
+/** A single compiled instruction */
+struct script_insn
+{
+	enum script_opcode op;
+	struct script_value arg[2];
+	struct script_cond cond;
+	struct signal_expression *expr;
+	const char *str;
+	conf_key_t key;
+	const char *text;
+	unsigned int target;
+	unsigned int line;
+};
+
+/** A compiled script */
+struct script_program
+{
+	const char *filename;
+	time_t mtime;
+	struct script_insn *insns;
+	unsigned int count;
+	unsigned int alloc;
+	struct script_program *next;
+};
+
+/** State used only while compiling a program */
+struct script_compiler
+{
+	struct script_program *prog;
+	unsigned int line;
+	unsigned int depth;
+	unsigned int block[MAX_SCRIPT_NESTING];
+	bool error;
+};
+
+/** An entry in the command table */
+struct script_command
+{
+	const char *name;
+	void (*compile) (struct script_compiler *, struct script_insn *);
+	enum script_opcode op;
+	struct script_command *chain;
+};
+
+/** The list of compiled script files, so that a file which is included
+many times is only read and parsed once */
+static struct script_program *script_cache;
+
+
 /**
  * Return the next token as a string.
  */
@@ -67,6 +212,11 @@ const char *tstring (void)
 		return t;
 
 	strcpy (tstringbuf, t+1);
+	if ((c = strchr (tstringbuf, '"')) != NULL)
+	{
+		*c = '\0';
+		return tstringbuf;
+	}
 	do {
 		t = tnext ();
 		if (!t)
@@ -84,49 +234,106 @@ const char *tstring (void)
 
 
 /**
- * Read the next token and interpret it as a constant.
- * Return its value.
+ * Parse an optional time unit after a number.
+ * Return the multiplier that converts it to milliseconds.
  */
-uint32_t tconst (void)
+static int tscale (void)
 {
 	const char *t = tnext ();
-	uint32_t i;
+	if (t)
+	{
+		if (teq (t, "ms"))
+			return 1;
+		else if (teq (t, "secs"))
+			return 1000;
+		tunget (t);
+	}
+	return 1;
+}
+
+
+/**
+ * Read the next token and interpret it as a value.  Constants are
+ * evaluated immediately; variable expansions are kept symbolic and
+ * looked up by tvalue_read() when the instruction is executed.
+ */
+static void tvalue (struct script_value *val)
+{
+	const char *t = tnext ();
+
+	val->type = VAL_CONST;
+	val->value = 0;
+	val->scale = 1;
+	val->name = NULL;
+	val->key = NULL;
 
 	/* If no value is given, default to 0. */
 	if (!t)
-		return 0;
+		return;
 
 	/* Interpret certain fixed strings */
 	if (teq (t, "on") || teq (t, "high") || teq (t, "active"))
-		return 1;
-	if (teq (t, "off") || teq (t, "low") || teq (t, "inactive"))
-		return 0;
+		val->value = 1;
+	else if (teq (t, "off") || teq (t, "low") || teq (t, "inactive"))
+		val->value = 0;
 
 	/* Dollar sign indicates a variable expansion */
-	if (*t == '$')
+	else if (*t == '$')
 	{
 		if (isdigit (t[1]))
-			return conf_read_stack (t[1] - '0');
+		{
+			val->type = VAL_STACK;
+			val->value = t[1] - '0';
+		}
 		else
-			return conf_read (t+1);
+		{
+			val->type = VAL_VAR;
+			val->name = strdup (t+1);
+		}
+		val->scale = tscale ();
 	}
 
 	/* TODO : Builtin strings */
 
-	/* Anything else is interpreted as a C-formatted number. */
-	i = strtoul (t, NULL, 0);
+	/* Anything else is interpreted as a C-formatted number, with
+	optional modifiers that can occur after it. */
+	else
+		val->value = strtoul (t, NULL, 0) * tscale ();
+}
 
-	/* Optional modifiers that can occur after the number */
-	t = tnext ();
-	if (t)
+
+/**
+ * Return the current value of a compiled operand.
+ */
+static int tvalue_read (struct script_value *val)
+{
+	switch (val->type)
 	{
-		if (teq (t, "ms"))
-			;
-		else if (teq (t, "secs"))
-			i *= 1000;
-		else
-			tunget (t);
+		case VAL_CONST:
+		default:
+			return val->value;
+		case VAL_VAR:
+			if (!val->key)
+				val->key = conf_key (val->name);
+			return val->key ? conf_get (val->key) * val->scale : 0;
+		case VAL_STACK:
+			return conf_read_stack (val->value) * val->scale;
 	}
+}
+
+
+/**
+ * Read the next token and interpret it as a constant.
+ * Return its value.
+ */
+uint32_t tconst (void)
+{
+	struct script_value val;
+	uint32_t i;
+
+	tvalue (&val);
+	i = tvalue_read (&val);
+	free ((void *)val.name);
 	return i;
 }
 
@@ -141,6 +348,8 @@ uint32_t tsigno (void)
 	const char *t = tnext ();
 	uint32_t signo;
 
+	if (!t)
+		return 0;
 	if (teq (t, "sol"))
 		signo = SIGNO_SOL;
 	else if (teq (t, "zerocross"))
@@ -149,6 +358,8 @@ uint32_t tsigno (void)
 		signo = SIGNO_TRIAC;
 	else if (teq (t, "lamp"))
 		signo = SIGNO_LAMP;
+	else if (teq (t, "sw"))
+		signo = SIGNO_SWITCH;
 	else if (teq (t, "sol_voltage"))
 		signo = SIGNO_SOL_VOLTAGE;
 	else if (teq (t, "ac_angle"))
@@ -207,6 +418,8 @@ struct signal_expression *texpr (void)
 				ex->u.binary.left = ex1;
 				ex->u.binary.right = ex2;
 			}
+			else
+				tunget (t);
 		}
 	}
 
@@ -228,179 +441,867 @@ struct signal_expression *texpr (void)
 }
 
 
-uint32_t tsw (void)
+/**
+ * Make a deep copy of a signal expression.  The capture module takes
+ * ownership of the expressions given to it, but a compiled program can
+ * be run more than once.
+ */
+static struct signal_expression *texpr_copy (struct signal_expression *ex)
+{
+	struct signal_expression *copy;
+
+	if (!ex)
+		return NULL;
+	copy = expr_alloc ();
+	*copy = *ex;
+	if (expr_binary_p (ex))
+	{
+		copy->u.binary.left = texpr_copy (ex->u.binary.left);
+		copy->u.binary.right = texpr_copy (ex->u.binary.right);
+	}
+	return copy;
+}
+
+
+/**
+ * Parse a switch name or number.
+ */
+static void tsw_value (struct script_value *val)
 {
 	const char *t;
 	uint32_t n;
 
 	t = tstring ();
-	for (n=0; n < NUM_SWITCHES; n++)
+	if (t)
 	{
-		const char *swname = names_of_switches[n];
-		if (swname && !strcmp (swname, t))
-			return n;
+		for (n=0; n < NUM_SWITCHES; n++)
+		{
+			const char *swname = names_of_switches[n];
+			if (swname && !strcmp (swname, t))
+			{
+				val->type = VAL_CONST;
+				val->value = n;
+				val->scale = 1;
+				val->name = NULL;
+				return;
+			}
+		}
 	}
 	tunget (t);
-	return tconst ();
+	tvalue (val);
+}
+
+
+uint32_t tsw (void)
+{
+	struct script_value val;
+	uint32_t n;
+
+	tsw_value (&val);
+	n = tvalue_read (&val);
+	free ((void *)val.name);
+	return n;
 }
 
 
 /**
- * Parse and execute a script command.
+ * Parse a condition, as used by 'if', 'while' and 'wait':
+ *
+ *   [not] sw <switch>       - true when the switch is logically active
+ *   [not] signal <signo>    - true when the signal is high
+ *   [not] clock <time>      - true once the simulated clock reaches <time>
+ *   [not] <value>           - true when the value is nonzero
  */
-void exec_script (char *cmd)
+static void tcond (struct script_cond *cond)
 {
-	const char *t;
-	uint32_t v, count;
-
-	tlast = NULL;
+	const char *t = tnext ();
 
-	/* Blank lines and comments are ignored */
-	t = tfirst (cmd);
+	cond->type = COND_TRUE;
+	cond->negate = FALSE;
+	cond->id = 0;
+	if (t && teq (t, "not"))
+	{
+		cond->negate = TRUE;
+		t = tnext ();
+	}
 	if (!t)
 		return;
-	if (*t == '#')
-		return;
 
-	/*********** capture [subcommand] [args...] ***************/
-	if (teq (t, "capture"))
+	if (teq (t, "sw"))
+	{
+		cond->type = COND_SWITCH;
+		cond->id = tsw ();
+	}
+	else if (teq (t, "signal"))
 	{
-		struct signal_expression *ex;
+		cond->type = COND_SIGNAL;
+		cond->id = tsigno ();
+	}
+	else if (teq (t, "clock"))
+	{
+		cond->type = COND_CLOCK;
+		tvalue (&cond->value);
+	}
+	else
+	{
+		tunget (t);
+		cond->type = COND_VALUE;
+		tvalue (&cond->value);
+	}
+}
 
-		t = tnext ();
-		if (teq (t, "start"))
-		{
-			ex = texpr ();
-			signal_capture_start (ex);
-		}
-		else if (teq (t, "stop"))
-		{
-			ex = texpr ();
-			signal_capture_stop (ex);
-		}
-		else if (teq (t, "debug"))
-		{
-		}
-		else if (teq (t, "file"))
-		{
-			t = tnext ();
-			signal_capture_set_file (t);
-		}
-		else if (teq (t, "add"))
-		{
-			signal_capture_add (tsigno ());
-		}
-		else if (teq (t, "del"))
-		{
-			signal_capture_del (tsigno ());
-		}
+
+/**
+ * Evaluate a condition at runtime.
+ */
+static bool tcond_eval (struct script_cond *cond)
+{
+	bool result;
+
+	switch (cond->type)
+	{
+		case COND_TRUE:
+		default:
+			result = TRUE;
+			break;
+		case COND_VALUE:
+			result = tvalue_read (&cond->value) != 0;
+			break;
+		case COND_SWITCH:
+			result = !!sim_switch_read (cond->id) ^ switch_is_opto (cond->id);
+			break;
+		case COND_SIGNAL:
+			result = signal_read (cond->id);
+			break;
+		case COND_CLOCK:
+			result = realtime_read () >= tvalue_read (&cond->value);
+			break;
 	}
+	return result ^ cond->negate;
+}
 
-	/*********** set [var] [value] ***************/
-	else if (teq (t, "set"))
+
+/*
+ * Compile handlers.  Each parses the arguments of one command
+ * into the instruction INSN, which has already been allocated
+ * with its opcode filled in.
+ */
+
+static void compile_capture (struct script_compiler *sc, struct script_insn *insn)
+{
+	const char *t = tnext ();
+
+	if (!t)
+		insn->op = OP_NOP;
+	else if (teq (t, "start"))
 	{
-		t = tnext ();
-		v = tconst ();
-		conf_write (t, v);
+		insn->op = OP_CAPTURE_START;
+		insn->expr = texpr ();
 	}
-	/*********** p/print [var] ***************/
-	else if (teq (t, "p") || teq (t, "print"))
+	else if (teq (t, "stop"))
 	{
-		v = tconst ();
-		simlog (SLC_DEBUG, "%d", v);
+		insn->op = OP_CAPTURE_STOP;
+		insn->expr = texpr ();
 	}
-	/*********** include [filename] ***************/
-	else if (teq (t, "include"))
+	else if (teq (t, "debug"))
+		insn->op = OP_NOP;
+	else if (teq (t, "file"))
 	{
+		insn->op = OP_CAPTURE_FILE;
 		t = tnext ();
-		exec_script_file (t);
+		insn->str = t ? strdup (t) : NULL;
 	}
-	/*********** sw [id] ***************/
-	else if (teq (t, "sw"))
+	else if (teq (t, "add"))
+	{
+		insn->op = OP_CAPTURE_ADD;
+		insn->target = tsigno ();
+	}
+	else if (teq (t, "del"))
+	{
+		insn->op = OP_CAPTURE_DEL;
+		insn->target = tsigno ();
+	}
+	else
+		insn->op = OP_NOP;
+}
+
+static void compile_named_value (struct script_compiler *sc, struct script_insn *insn)
+{
+	const char *t = tnext ();
+	if (!t)
 	{
-		v = tsw ();
-		count = tconst ();
-		if (count == 0)
-			count = 1;
-		while (count > 0)
+		simlog (SLC_DEBUG, "line %d: missing variable name", sc->line);
+		sc->error = TRUE;
+		return;
+	}
+	insn->str = strdup (t);
+
+	/* 'set' also accepts a quoted string or a floating-point number,
+	which is converted according to the type of the variable */
+	if (insn->op == OP_SET && (t = tnext ()) != NULL)
+	{
+		tunget (t);
+		if (*t == '"')
+			t = tstring ();
+		else if (*t == '$' || !strpbrk (t, ".eE") || strtod (t, NULL) == strtol (t, NULL, 0))
+			t = NULL;
+		if (t)
 		{
-			sim_switch_depress (v);
-			count--;
+			insn->op = OP_SET_TEXT;
+			insn->text = strdup (t);
+			return;
 		}
 	}
-	/*********** swtoggle [id] ***************/
-	else if (teq (t, "swtoggle"))
+	tvalue (&insn->arg[0]);
+}
+
+/**
+ * Return the configuration handle for the variable named by an
+ * instruction, resolving it on first use.
+ */
+static conf_key_t script_insn_key (struct script_insn *insn)
+{
+	if (!insn->key)
+		insn->key = conf_key (insn->str);
+	if (!insn->key)
+		simlog (SLC_DEBUG, "No such conf item '%s'", insn->str);
+	return insn->key;
+}
+
+static void compile_conf (struct script_compiler *sc, struct script_insn *insn)
+{
+	const char *t = tnext ();
+
+	if (t && teq (t, "load"))
+		insn->op = OP_CONF_LOAD;
+	else if (t && teq (t, "save"))
+		insn->op = OP_CONF_SAVE;
+	else
+	{
+		simlog (SLC_DEBUG, "line %d: expected 'conf load' or 'conf save'", sc->line);
+		sc->error = TRUE;
+		return;
+	}
+
+	t = tstring ();
+	insn->str = t ? strdup (t) : NULL;
+}
+
+static void compile_journal (struct script_compiler *sc, struct script_insn *insn)
+{
+	const char *t = tnext ();
+
+	if (t && teq (t, "record"))
+		insn->op = OP_JOURNAL_RECORD;
+	else if (t && teq (t, "replay"))
+		insn->op = OP_JOURNAL_REPLAY;
+	else if (t && teq (t, "stop"))
+	{
+		insn->op = OP_JOURNAL_STOP;
+		return;
+	}
+	else
+	{
+		simlog (SLC_DEBUG, "line %d: expected 'journal record', 'replay' or 'stop'", sc->line);
+		sc->error = TRUE;
+		return;
+	}
+
+	t = tstring ();
+	insn->str = t ? strdup (t) : NULL;
+}
+
+static void compile_value (struct script_compiler *sc, struct script_insn *insn)
+{
+	tvalue (&insn->arg[0]);
+}
+
+static void compile_string (struct script_compiler *sc, struct script_insn *insn)
+{
+	const char *t = tstring ();
+	insn->str = t ? strdup (t) : NULL;
+}
+
+static void compile_switch (struct script_compiler *sc, struct script_insn *insn)
+{
+	tsw_value (&insn->arg[0]);
+	tvalue (&insn->arg[1]);
+}
+
+static void compile_key (struct script_compiler *sc, struct script_insn *insn)
+{
+	const char *t = tnext ();
+	if (!t)
+	{
+		sc->error = TRUE;
+		return;
+	}
+	insn->str = strdup (t);
+	tsw_value (&insn->arg[0]);
+}
+
+static void compile_wait (struct script_compiler *sc, struct script_insn *insn)
+{
+	const char *t;
+
+	tcond (&insn->cond);
+	t = tnext ();
+	if (t && teq (t, "timeout"))
+		tvalue (&insn->arg[0]);
+	else
+		insn->arg[0].type = VAL_CONST;
+}
+
+static void block_open (struct script_compiler *sc)
+{
+	if (sc->depth >= MAX_SCRIPT_NESTING)
+	{
+		simlog (SLC_DEBUG, "line %d: blocks nested too deeply", sc->line);
+		sc->error = TRUE;
+		return;
+	}
+	sc->block[sc->depth++] = sc->prog->count - 1;
+}
+
+static void compile_loop (struct script_compiler *sc, struct script_insn *insn)
+{
+	const char *t = tnext ();
+
+	if (!t || teq (t, "forever"))
+	{
+		insn->arg[0].type = VAL_CONST;
+		insn->arg[0].value = SCRIPT_FOREVER;
+	}
+	else
 	{
-		v = tsw ();
-		count = tconst ();
-		if (count == 0)
-			count = 1;
-		while (count > 0)
+		tunget (t);
+		tvalue (&insn->arg[0]);
+	}
+	block_open (sc);
+}
+
+static void compile_cond_block (struct script_compiler *sc, struct script_insn *insn)
+{
+	tcond (&insn->cond);
+	block_open (sc);
+}
+
+static void compile_else (struct script_compiler *sc, struct script_insn *insn)
+{
+	struct script_insn *open;
+
+	if (sc->depth == 0)
+		goto mismatch;
+	open = &sc->prog->insns[sc->block[sc->depth-1]];
+	if (open->op != OP_IF)
+		goto mismatch;
+
+	/* The 'else' becomes a jump to the end of the block; a false 'if'
+	lands just after it. */
+	insn->op = OP_JUMP;
+	open->target = sc->prog->count;
+	sc->block[sc->depth-1] = sc->prog->count - 1;
+	return;
+
+mismatch:
+	simlog (SLC_DEBUG, "line %d: 'else' without 'if'", sc->line);
+	sc->error = TRUE;
+}
+
+static void compile_end (struct script_compiler *sc, struct script_insn *insn)
+{
+	unsigned int start;
+	struct script_insn *open;
+
+	if (sc->depth == 0)
+	{
+		simlog (SLC_DEBUG, "line %d: 'end' without a block", sc->line);
+		sc->error = TRUE;
+		return;
+	}
+	start = sc->block[--sc->depth];
+	open = &sc->prog->insns[start];
+
+	switch (open->op)
+	{
+		case OP_LOOP:
+			/* Loop back to the first instruction in the body; the loop
+			header skips past here when the count is zero. */
+			insn->op = OP_LOOP_END;
+			insn->target = start + 1;
+			open->target = sc->prog->count;
+			break;
+
+		case OP_WHILE:
+			/* A 'while' block jumps back to re-test its condition */
+			insn->op = OP_JUMP;
+			insn->target = start;
+			open->target = sc->prog->count;
+			break;
+
+		case OP_IF:
+		case OP_JUMP:
+			/* The end of an 'if' block, or the 'else' part of one */
+			open->target = sc->prog->count;
+			break;
+
+		default:
+			break;
+	}
+}
+
+
+/** The command table.  Entries are hashed by name on first use. */
+static struct script_command script_commands[] = {
+	{ "capture", compile_capture, OP_NOP },
+	{ "set", compile_named_value, OP_SET },
+	{ "add", compile_named_value, OP_ADD },
+	{ "var", compile_named_value, OP_VAR },
+	{ "p", compile_value, OP_PRINT },
+	{ "print", compile_value, OP_PRINT },
+	{ "include", compile_string, OP_INCLUDE },
+	{ "sw", compile_switch, OP_SW },
+	{ "swtoggle", compile_switch, OP_SWTOGGLE },
+	{ "key", compile_key, OP_KEY },
+	{ "push", compile_value, OP_PUSH },
+	{ "pop", compile_value, OP_POP },
+	{ "sleep", compile_value, OP_SLEEP },
+	{ "wait", compile_wait, OP_WAIT },
+	{ "exit", NULL, OP_EXIT },
+	{ "loop", compile_loop, OP_LOOP },
+	{ "while", compile_cond_block, OP_WHILE },
+	{ "if", compile_cond_block, OP_IF },
+	{ "else", compile_else, OP_JUMP },
+	{ "end", compile_end, OP_NOP },
+	{ "conf", compile_conf, OP_NOP },
+	{ "journal", compile_journal, OP_NOP },
+};
+
+static struct script_command *script_command_hash[SCRIPT_HASH_SIZE];
+
+static unsigned int script_hash (const char *name)
+{
+	unsigned int hash = 0;
+	while (*name)
+	{
+		hash = hash * 17 + *name;
+		name++;
+	}
+	return hash % SCRIPT_HASH_SIZE;
+}
+
+static struct script_command *script_command_find (const char *name)
+{
+	static bool script_command_hash_ready = FALSE;
+	struct script_command *cmd;
+
+	if (!script_command_hash_ready)
+	{
+		int n;
+		for (n = 0; n < sizeof (script_commands) / sizeof (script_commands[0]); n++)
 		{
-			sim_switch_toggle (v);
-			count--;
+			unsigned int hash = script_hash (script_commands[n].name);
+			script_commands[n].chain = script_command_hash[hash];
+			script_command_hash[hash] = &script_commands[n];
 		}
+		script_command_hash_ready = TRUE;
 	}
-	/*********** key [keyname] [switch] ***************/
-	else if (teq (t, "key"))
+
+	for (cmd = script_command_hash[script_hash (name)]; cmd; cmd = cmd->chain)
+		if (teq (cmd->name, name))
+			return cmd;
+	return NULL;
+}
+
+
+/**
+ * Allocate a new program.
+ */
+static struct script_program *script_program_alloc (const char *filename)
+{
+	struct script_program *prog = malloc (sizeof (struct script_program));
+	memset (prog, 0, sizeof (struct script_program));
+	prog->filename = filename ? strdup (filename) : NULL;
+	return prog;
+}
+
+
+/**
+ * Free a program and all of its instructions.
+ */
+static void script_program_free (struct script_program *prog)
+{
+	unsigned int n;
+	for (n = 0; n < prog->count; n++)
 	{
-		t = tnext ();
-		v = tsw ();
-		simlog (SLC_DEBUG, "Key '%c' = %s", *t, names_of_switches[v]);
-		sim_key_install (*t, v);
+		struct script_insn *insn = &prog->insns[n];
+		expr_free (insn->expr);
+		free ((void *)insn->str);
+		free ((void *)insn->text);
+		free ((void *)insn->arg[0].name);
+		free ((void *)insn->arg[1].name);
+		free ((void *)insn->cond.value.name);
 	}
-	/*********** push [value] ***************/
-	else if (teq (t, "push"))
+	free (prog->insns);
+	free ((void *)prog->filename);
+	free (prog);
+}
+
+
+/**
+ * Compile one line of script into zero or more instructions.
+ */
+static void script_compile_line (struct script_compiler *sc, char *cmd)
+{
+	struct script_program *prog = sc->prog;
+	struct script_command *command;
+	struct script_insn *insn;
+	const char *t;
+
+	tlast = NULL;
+
+	/* Blank lines and comments are ignored */
+	t = tfirst (cmd);
+	if (!t)
+		return;
+	if (*t == '#')
+		return;
+
+	command = script_command_find (t);
+	if (!command)
 	{
-		v = tconst ();
-		conf_push (v);
+		simlog (SLC_DEBUG, "line %d: unknown command '%s'", sc->line, t);
+		return;
 	}
-	/*********** pop [argcount] ***************/
-	else if (teq (t, "pop"))
+
+	if (prog->count == prog->alloc)
 	{
-		v = tconst ();
-		conf_pop (v);
+		prog->alloc = prog->alloc ? prog->alloc * 2 : 16;
+		prog->insns = realloc (prog->insns, prog->alloc * sizeof (struct script_insn));
 	}
-	/*********** sleep [time] ***************/
-	else if (teq (t, "sleep"))
+	insn = &prog->insns[prog->count++];
+	memset (insn, 0, sizeof (struct script_insn));
+	insn->op = command->op;
+	insn->line = sc->line;
+	if (command->compile)
+		command->compile (sc, insn);
+}
+
+
+/**
+ * Finish compiling a program.  Returns FALSE if the program is
+ * not valid and should not be executed.
+ */
+static bool script_compile_finish (struct script_compiler *sc)
+{
+	if (sc->depth != 0)
 	{
-		v = tconst ();
-		simlog (SLC_DEBUG, "Sleeping for %d ms", v);
-		v /= IRQS_PER_TICK;
-		do {
-			task_sleep (TIME_16MS);
-		} while (--v > 0);
-		simlog (SLC_DEBUG, "Awake again.", v);
+		simlog (SLC_DEBUG, "line %d: missing 'end'", sc->line);
+		sc->error = TRUE;
 	}
-	/*********** exit ***************/
-	else if (teq (t, "exit"))
+	return !sc->error;
+}
+
+
+/**
+ * Sleep for the given number of milliseconds.
+ */
+static void script_sleep (unsigned int ms)
+{
+	unsigned int ticks = ms / IRQS_PER_TICK;
+	do {
+		task_sleep (TIME_16MS);
+	} while (ticks-- > 1);
+}
+
+
+/**
+ * Execute a compiled program.
+ */
+static void script_run (struct script_program *prog)
+{
+	int loop_count[MAX_SCRIPT_NESTING];
+	unsigned int loop_depth = 0;
+	unsigned int pc = 0;
+	unsigned int count;
+	int v;
+
+	while (pc < prog->count)
 	{
-		sim_exit (0);
+		struct script_insn *insn = &prog->insns[pc++];
+		switch (insn->op)
+		{
+			case OP_NOP:
+				break;
+
+			/*********** capture [subcommand] [args...] ***************/
+			case OP_CAPTURE_START:
+				signal_capture_start (texpr_copy (insn->expr));
+				break;
+
+			case OP_CAPTURE_STOP:
+				signal_capture_stop (texpr_copy (insn->expr));
+				break;
+
+			case OP_CAPTURE_FILE:
+				signal_capture_set_file (insn->str);
+				break;
+
+			case OP_CAPTURE_ADD:
+				signal_capture_add (insn->target);
+				break;
+
+			case OP_CAPTURE_DEL:
+				signal_capture_del (insn->target);
+				break;
+
+			/*********** set [var] [value] ***************/
+			case OP_SET:
+				if (script_insn_key (insn))
+					conf_set (insn->key, tvalue_read (&insn->arg[0]));
+				break;
+
+			case OP_SET_TEXT:
+				if (script_insn_key (insn))
+					conf_set_string (insn->key, insn->text);
+				break;
+
+			/*********** add [var] [value] ***************/
+			case OP_ADD:
+				if (script_insn_key (insn))
+					conf_set (insn->key, conf_get (insn->key) + tvalue_read (&insn->arg[0]));
+				break;
+
+			/*********** var [var] [value] ***************/
+			case OP_VAR:
+				if (!conf_defined (insn->str))
+				{
+					int *valp = malloc (sizeof (int));
+					*valp = 0;
+					conf_add (insn->str, valp);
+				}
+				if (script_insn_key (insn))
+					conf_set (insn->key, tvalue_read (&insn->arg[0]));
+				break;
+
+			/*********** conf load/save [filename] ***************/
+			case OP_CONF_LOAD:
+				if (insn->str)
+					conf_load (insn->str);
+				break;
+
+			case OP_CONF_SAVE:
+				if (insn->str)
+					conf_save (insn->str);
+				break;
+
+			/*********** journal record/replay/stop [filename] ***************/
+			case OP_JOURNAL_RECORD:
+				if (insn->str)
+					journal_record (insn->str);
+				break;
+
+			case OP_JOURNAL_REPLAY:
+				if (insn->str)
+					journal_replay (insn->str);
+				break;
+
+			case OP_JOURNAL_STOP:
+				journal_stop ();
+				break;
+
+			/*********** p/print [var] ***************/
+			case OP_PRINT:
+				simlog (SLC_DEBUG, "%d", tvalue_read (&insn->arg[0]));
+				break;
+
+			/*********** include [filename] ***************/
+			case OP_INCLUDE:
+				if (insn->str)
+					exec_script_file (insn->str);
+				break;
+
+			/*********** sw [id] ***************/
+			/*********** swtoggle [id] ***************/
+			case OP_SW:
+			case OP_SWTOGGLE:
+				v = tvalue_read (&insn->arg[0]);
+				count = tvalue_read (&insn->arg[1]);
+				if (count == 0)
+					count = 1;
+				while (count > 0)
+				{
+					if (insn->op == OP_SW)
+						sim_switch_depress (v);
+					else
+						sim_switch_toggle (v);
+					count--;
+				}
+				break;
+
+			/*********** key [keyname] [switch] ***************/
+			case OP_KEY:
+				v = tvalue_read (&insn->arg[0]);
+				simlog (SLC_DEBUG, "Key '%c' = %s", *insn->str, names_of_switches[v]);
+				sim_key_install (*insn->str, v);
+				break;
+
+			/*********** push [value] ***************/
+			case OP_PUSH:
+				conf_push (tvalue_read (&insn->arg[0]));
+				break;
+
+			/*********** pop [argcount] ***************/
+			case OP_POP:
+				conf_pop (tvalue_read (&insn->arg[0]));
+				break;
+
+			/*********** sleep [time] ***************/
+			case OP_SLEEP:
+				v = tvalue_read (&insn->arg[0]);
+				simlog (SLC_DEBUG, "Sleeping for %d ms", v);
+				script_sleep (v);
+				simlog (SLC_DEBUG, "Awake again.");
+				break;
+
+			/*********** wait [condition] [timeout time] ***************/
+			case OP_WAIT:
+			{
+				unsigned long deadline = 0;
+
+				v = tvalue_read (&insn->arg[0]);
+				if (v > 0)
+					deadline = realtime_read () + v;
+				while (!tcond_eval (&insn->cond))
+				{
+					if (deadline && realtime_read () >= deadline)
+					{
+						simlog (SLC_DEBUG, "line %d: wait timed out", insn->line);
+						break;
+					}
+					task_sleep (SCRIPT_POLL_TICKS);
+				}
+				break;
+			}
+
+			/*********** exit ***************/
+			case OP_EXIT:
+				sim_exit (0);
+				break;
+
+			/*********** loop [count|forever] ... end ***************/
+			case OP_LOOP:
+				v = tvalue_read (&insn->arg[0]);
+				if (v == 0 || (v < 0 && v != SCRIPT_FOREVER)
+					|| loop_depth >= MAX_SCRIPT_NESTING)
+					pc = insn->target;
+				else
+					loop_count[loop_depth++] = v;
+				break;
+
+			case OP_LOOP_END:
+				if (loop_count[loop_depth-1] == SCRIPT_FOREVER
+					|| --loop_count[loop_depth-1] > 0)
+					pc = insn->target;
+				else
+					loop_depth--;
+				break;
+
+			/*********** if/while [condition] ... [else] ... end ***************/
+			case OP_IF:
+			case OP_WHILE:
+				if (!tcond_eval (&insn->cond))
+					pc = insn->target;
+				break;
+
+			case OP_JUMP:
+				pc = insn->target;
+				break;
+		}
 	}
 }
 
 
 /**
- * Execute a series of script commands in the named file.
+ * Parse and execute a script command.
  */
-void exec_script_file (const char *filename)
+void exec_script (char *cmd)
 {
+	struct script_compiler sc;
+
+	memset (&sc, 0, sizeof (sc));
+	sc.prog = script_program_alloc (NULL);
+	sc.line = 1;
+	script_compile_line (&sc, cmd);
+	if (script_compile_finish (&sc))
+		script_run (sc.prog);
+	script_program_free (sc.prog);
+}
+
+
+/**
+ * Compile a script file, or return a cached copy if the file has
+ * already been compiled and has not changed since.
+ */
+static struct script_program *script_load (const char *filename)
+{
+	struct script_program *prog, **progp;
+	struct script_compiler sc;
+	struct stat st;
 	FILE *in;
 	char buf[256];
 
+	if (stat (filename, &st) < 0)
+		return NULL;
+
+	for (progp = &script_cache; (prog = *progp) != NULL; progp = &prog->next)
+		if (teq (prog->filename, filename))
+		{
+			if (prog->mtime == st.st_mtime)
+				return prog;
+			*progp = prog->next;
+			script_program_free (prog);
+			break;
+		}
+
 	in = fopen (filename, "r");
 	if (!in)
-		return;
-	simlog (SLC_DEBUG, "Reading commands from '%s'", filename);
-	for (;;)
+		return NULL;
+
+	memset (&sc, 0, sizeof (sc));
+	sc.prog = prog = script_program_alloc (filename);
+	prog->mtime = st.st_mtime;
+	while (fgets (buf, 255, in))
 	{
-		if (!fgets (buf, 255, in))
-			break;
-		if (feof (in))
-			break;
-		exec_script (buf);
+		sc.line++;
+		script_compile_line (&sc, buf);
 	}
-	simlog (SLC_DEBUG, "Closing '%s'", filename);
 	fclose (in);
+
+	if (!script_compile_finish (&sc))
+	{
+		simlog (SLC_DEBUG, "'%s' not executed due to errors", filename);
+		script_program_free (prog);
+		return NULL;
+	}
+
+	prog->next = script_cache;
+	script_cache = prog;
+	return prog;
 }
 
+
+/**
+ * Execute a series of script commands in the named file.
+ */
+void exec_script_file (const char *filename)
+{
+	struct script_program *prog;
+
+	prog = script_load (filename);
+	if (!prog)
+		return;
+	simlog (SLC_DEBUG, "Reading commands from '%s'", filename);
+	script_run (prog);
+	simlog (SLC_DEBUG, "Closing '%s'", filename);
+}
@@ -139,6 +139,16 @@ double signal_value (uint32_t signo)
 }
 
 
+/**
+ * Return the current state of a signal as true/false.  Auto signals
+ * are true whenever their value is nonzero.
+ */
+bool signal_read (uint32_t signo)
+{
+	return signal_value (signo) != 0.0;
+}
+
+
 /**
  * Allocate a new signal expression tree node.
  */
@@ -513,6 +523,8 @@ void signal_trace_stop (signal_number_t signo)
  */
 void signal_init (void)
 {
+	/* All signals are low until they are first updated */
+	memset (signal_states, 0xFF, sizeof (signal_states));
 	signal_start_expr = signal_stop_expr = NULL;
 	signal_capture_active = 0;
 	sim_time_register (1, TRUE, signal_trace_periodic, NULL);
@@ -30,6 +30,7 @@ static void sound_ext_reset (void)
 void sound_ext_command (U16 cmd)
 {
 	ui_write_sound_command (cmd);
+	audio_write (cmd);
 }
 
 static void sound_ext_write_data (U8 val)
@@ -62,6 +62,7 @@ void sim_switch_toggle (int sw)
 	if (sim_no_opto_power && switch_is_opto (sw))
 		return;
 
+	journal_switch_toggle (sw);
 	sim_switch_matrix[sw / 8] ^= (1 << (sw % 8));
 	sim_switch_update (sw);
 }
@@ -73,6 +74,7 @@ void sim_switch_set (int sw, int on)
 	if (sim_no_opto_power && switch_is_opto (sw))
 		return;
 
+	journal_switch_set (sw, on);
 	if (switch_is_opto (sw))
 		on = !on;
 	if (on)
@@ -45,6 +45,21 @@ unsigned int ring_now = 0;
  * by the position in the array. */
 struct time_handler *time_handler_ring[RING_COUNT] = { NULL, };
 
+/** Nonzero while sim_time_step is calling the timers of the current slot */
+static int ring_stepping;
+
+
+/** Return the number of extra trips around the ring a timer needs
+ * before it expires N_TICKS from now.  While a step is in progress, the
+ * current slot has already been taken off the ring, so a timer put into
+ * it is a whole lap away already. */
+static unsigned int ring_laps (unsigned int n_ticks)
+{
+	if (ring_stepping && n_ticks > 0)
+		return (n_ticks - 1) / RING_COUNT;
+	return n_ticks / RING_COUNT;
+}
+
 
 /** Allocate a new timer ring entry */
 static struct time_handler *ring_malloc (void)
@@ -64,8 +79,9 @@ static void ring_free (struct time_handler *elem)
  * PERIOIDIC_P is nonzero if the timer function should be called repeatedly,
  * every time that much time has elapsed.
  * FN is the function to be called and DATA can be anything at all, passed to
- * the handler. */
-void sim_time_register (int n_ticks, int periodic_p, time_handler_t fn, void *data)
+ * the handler.  Returns a handle that can be passed to sim_time_cancel()
+ * until the timer expires. */
+struct time_handler *sim_time_register (int n_ticks, int periodic_p, time_handler_t fn, void *data)
 {
 	unsigned int ring = ring_later (n_ticks);
 
@@ -73,14 +89,25 @@ void sim_time_register (int n_ticks, int periodic_p, time_handler_t fn, void *da
 	if (!elem)
 		simlog (SLC_DEBUG, "can't alloc ring");
 
-	if (n_ticks > RING_COUNT)
-		simlog (SLC_DEBUG, "can't schedule timer that far out");
-
+	/* Timers further out than the size of the ring go around it
+	more than once before they expire. */
 	elem->next = time_handler_ring[ring];
 	elem->periodicity = periodic_p ? n_ticks : 0;
+	elem->laps = ring_laps (n_ticks);
 	elem->fn = fn;
 	elem->data = data;
 	time_handler_ring[ring] = elem;
+	return elem;
+}
+
+
+/** Cancel a timer before it expires.  The entry is not unlinked from
+ * the ring here; it is only marked dead, and freed when its slot
+ * comes around. */
+void sim_time_cancel (struct time_handler *elem)
+{
+	elem->fn = NULL;
+	elem->periodicity = 0;
 }
 
 
@@ -97,18 +124,43 @@ void sim_time_step (void)
 	 * be executed on this tick */
 	elem = time_handler_ring[ring_now];
 	time_handler_ring[ring_now] = NULL;
+	ring_stepping = 1;
 
 	/* Call each timer function */
 	while (elem != NULL)
 	{
+		/* Drop timers that were cancelled */
+		if (elem->fn == NULL)
+		{
+			elem_next = elem->next;
+			ring_free (elem);
+			elem = elem_next;
+			continue;
+		}
+
+		/* If the timer needs more trips around the ring, put it
+		back where it was */
+		if (elem->laps)
+		{
+			elem->laps--;
+			elem_next = elem->next;
+			elem->next = time_handler_ring[ring_now];
+			time_handler_ring[ring_now] = elem;
+			elem = elem_next;
+			continue;
+		}
+
 		(*elem->fn) (elem->data);
 
+		/* The handler may have cancelled a periodic timer, in which
+		case it is freed below like a one-shot */
 		if (elem->periodicity)
 		{
 			/* If periodic, just requeue it rather than free/alloc */
 			elem_next = elem->next;
 
 
+			elem->laps = ring_laps (elem->periodicity);
 			periodic = time_handler_ring[ring_later (elem->periodicity)];
 			if (!periodic)
 			{
@@ -130,6 +182,7 @@ void sim_time_step (void)
 			elem = elem_next;
 		}
 	}
+	ring_stepping = 0;
 	ring_now = ring_later (1);
 }
 
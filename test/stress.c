@@ -73,7 +73,6 @@ void switch_stress_task (void)
 {
 	U8 sw;
 	const switch_info_t *swinfo;
-	task_pid_t tp;
 
 	/* Delay a few seconds before starting the simulation.  This allows
 	time for the Start Button to be used to add players, instead of simulating
@@ -133,8 +132,7 @@ void switch_stress_task (void)
 		else if (swinfo->flags & SW_PLAYFIELD)
 		{
 			/* Simulate the switch */
-			tp = task_create_gid (GID_SW_HANDLER, switch_sched_task);
-			task_set_arg (tp, sw);
+			switch_schedule (sw);
 		}
 	}
 }
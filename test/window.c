@@ -573,6 +573,9 @@ struct audit standard_audits[] = {
 	{ "RIGHT FLIPPER", AUDIT_TYPE_INT, &system_audits.right_flippers },
 	{ "TROUGH RESCUE", AUDIT_TYPE_INT, &system_audits.trough_rescues },
 	{ "CHASE BALLS", AUDIT_TYPE_INT, &system_audits.chase_balls },
+	{ "SOUND QUEUE MAX", AUDIT_TYPE_INT, &system_audits.sound_queue_max },
+	{ "SOUND DROPS", AUDIT_TYPE_INT, &system_audits.sound_drops },
+	{ "TASKS SHED", AUDIT_TYPE_INT, &system_audits.tasks_shed },
 	{ "LOCKUP 1 ADDR", AUDIT_TYPE_INT, &system_audits.lockup1_addr },
 	{ "LOCKUP 1 PID/LEF", AUDIT_TYPE_INT, &system_audits.lockup1_pid_lef },
 	{ NULL, AUDIT_TYPE_NONE, NULL },
@@ -1893,6 +1896,69 @@ struct menu irqload_test_item = {
 
 /**********************************************************************/
 
+#ifdef CONFIG_MALLOC
+
+void malloc_stats_init (void)
+{
+	browser_init ();
+	browser_max = NUM_MALLOC_CLASSES-1;
+}
+
+void malloc_stats_draw (void)
+{
+	struct malloc_class_stats *stats = &malloc_stats[menu_selection];
+
+	sprintf ("MALLOC %d BYTES", chunk_sizes[menu_selection]);
+	print_row_center (&font_var5, 2);
+
+	sprintf ("ALLOCS %ld", stats->allocs);
+	font_render_string_left (&font_var5, 4, 9, sprintf_buffer);
+
+	sprintf ("FAILS %d", stats->fails);
+	font_render_string_left (&font_var5, 4, 16, sprintf_buffer);
+
+	sprintf ("CHUNKS %d", stats->chunks);
+	font_render_string_left (&font_var5, 4, 23, sprintf_buffer);
+
+	sprintf ("IN USE %ld", stats->in_use);
+	font_render_string_left (&font_var5, 64, 9, sprintf_buffer);
+
+	sprintf ("PEAK %ld", stats->peak);
+	font_render_string_left (&font_var5, 64, 16, sprintf_buffer);
+
+	sprintf ("RESERVE %d", stats->reserve);
+	font_render_string_left (&font_var5, 64, 23, sprintf_buffer);
+
+	dmd_show_low ();
+}
+
+void malloc_stats_thread (void)
+{
+	for (;;)
+	{
+		task_sleep (TIME_500MS);
+		dmd_alloc_low_clean ();
+		malloc_stats_draw ();
+	}
+}
+
+struct window_ops malloc_stats_window = {
+	INHERIT_FROM_BROWSER,
+	.init = malloc_stats_init,
+	.draw = malloc_stats_draw,
+	.thread = malloc_stats_thread,
+};
+
+struct menu malloc_stats_item = {
+	.name = "MALLOC STATS",
+	.flags = M_ITEM,
+	.var = { .subwindow = { &malloc_stats_window, NULL } },
+};
+
+#endif /* CONFIG_MALLOC */
+
+/**********************************************************************/
+
 #define SCORE_TEST_PLAYERS 4
 
 const score_t score_test_increment = { 0x00, 0x01, 0x23, 0x45, 0x60 };
@@ -2147,6 +2213,9 @@ struct menu *dev_menu_items[] = {
 	&irqload_test_item,
 #endif
 	&score_test_item,
+#ifdef CONFIG_MALLOC
+	&malloc_stats_item,
+#endif
 #if (MACHINE_PIC == 1)
 	&pic_test_item,
 #endif
@@ -0,0 +1,128 @@
+/*
+ * Copyright 2011 by Brian Dominy <brian@oddchange.com>
+ *
+ * This file is part of FreeWPC.
+ *
+ * FreeWPC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeWPC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeWPC; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* This program prints an event log exported by log_export, such as the
+build/event.log written by a native build with CONFIG_LOG, in the same
+form as the 'l' command in the debugger, with the time of each event
+since the first.
+
+	logdecode [file]
+
+With no file, the log is read from standard input. */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+typedef uint8_t U8;
+typedef uint16_t U16;
+#define __permanent__
+
+#include "include/log.h"
+
+const char *module_names[] = {
+	[MOD_DEFF] = "Deff",
+	[MOD_LAMP] = "Lamp",
+	[MOD_SOUND] = "Sound",
+	[MOD_TASK] = "Task",
+	[MOD_SWITCH] = "Sw",
+	[MOD_TRIAC] = "Triac",
+	[MOD_GAME] = "Game",
+	[MOD_SYSTEM] = "Sys",
+	[MOD_PRICING] = "Pricing",
+	[MOD_SOL] = "Sol",
+};
+
+#define NUM_MODULES (sizeof (module_names) / sizeof (module_names[0]))
+
+
+/* The same names as log_get_format in kernel/log.c */
+const char *event_name (U8 module, U8 event)
+{
+	switch (event)
+	{
+		case EV_START:
+			return "start";
+		case EV_STOP:
+			return "stop";
+		case EV_EXIT:
+			return "exit";
+	}
+
+	switch (make_module_event (module, event))
+	{
+		case make_module_event(MOD_LAMP, EV_BIT_ON):
+			return "flag on";
+		case make_module_event(MOD_LAMP, EV_BIT_OFF):
+			return "flag off";
+		case make_module_event(MOD_LAMP, EV_BIT_TOGGLE):
+			return "flag toggle";
+		case make_module_event(MOD_TASK, EV_TASK_RESTART):
+			return "restart";
+		case make_module_event(MOD_TASK, EV_TASK_START1):
+			return "start1";
+		case make_module_event(MOD_SYSTEM, EV_SYSTEM_NONFATAL):
+			return "nonfatal";
+		case make_module_event(MOD_SYSTEM, EV_SYSTEM_FATAL):
+			return "fatal";
+		case make_module_event(MOD_SOL, EV_DEV_ENTER):
+			return "deventer";
+		case make_module_event(MOD_SOL, EV_DEV_KICK):
+			return "devkick";
+	}
+	return "?";
+}
+
+
+int main (int argc, char *argv[])
+{
+	FILE *fp = stdin;
+	char magic[4];
+	U8 rec[4];
+	unsigned long ms = 0;
+	unsigned int count = 0;
+
+	if (argc > 1 && (fp = fopen (argv[1], "rb")) == NULL)
+	{
+		fprintf (stderr, "logdecode: can't open %s\n", argv[1]);
+		return 1;
+	}
+
+	if (fread (magic, 4, 1, fp) != 1 || memcmp (magic, LOG_EXPORT_MAGIC, 4))
+	{
+		fprintf (stderr, "logdecode: not an event log\n");
+		return 1;
+	}
+
+	while (fread (rec, 4, 1, fp) == 1)
+	{
+		/* The first timestamp is from before the oldest event that
+		was kept, so times are given from the first event shown. */
+		if (count++)
+			ms += log_timestamp_ticks (rec[0]) * 16UL;
+		printf ("%8lu.%03lu%s %-7s %-11s %02X\n", ms / 1000, ms % 1000,
+			rec[0] == 0xFF ? "+" : " ",
+			rec[1] < NUM_MODULES && module_names[rec[1]] ? module_names[rec[1]] : "?",
+			event_name (rec[1], rec[2]), rec[3]);
+	}
+
+	printf ("%u events\n", count);
+	return 0;
+}
@@ -0,0 +1,247 @@
+/*
+ * Copyright 2011 by Brian Dominy <brian@oddchange.com>
+ *
+ * This file is part of FreeWPC.
+ *
+ * FreeWPC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeWPC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeWPC; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* This program runs the 6809 malloc() from cpu/m6809/malloc.c on the
+build machine, against a task table of the same size, and reports how
+well it does under a random load of allocations and frees.
+
+The pointers in a chunk header are larger here than on the 6809, so
+CHUNK_DATA_SIZE is fixed at the value that the real task block gives,
+and the same number of userblocks fit in each chunk.
+
+	mallocbench [-n ops] [-l live] [-m max-size] [-t task-blocks]
+		[-c collect-interval] [-s seed]
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <setjmp.h>
+#include <unistd.h>
+#include <time.h>
+
+typedef uint8_t U8;
+typedef uint16_t U16;
+typedef int bool;
+#define TRUE 1
+#define FALSE 0
+
+/** The size of the task table, from include/system/task.h */
+#define NUM_TASKS 48
+
+/** The bytes of a 59-byte task block that follow the 6-byte chunk
+header on the 6809 */
+#ifndef CHUNK_DATA_SIZE
+#define CHUNK_DATA_SIZE 53
+#endif
+
+#define BLOCK_FREE 0x0
+#define BLOCK_USED 0x1
+#define BLOCK_MALLOC 0x2
+
+#define ERR_NO_FREE_TASKS 1
+#define ERR_MALLOC 2
+
+typedef struct { U8 state; } task_t;
+
+task_t *block_allocate (void);
+void block_free (task_t *tp);
+static void fatal (int err) __attribute__((noreturn));
+
+/* The rest of the system is not here, so the calls that malloc.c makes
+into it do nothing, or run at once. */
+#define dbprintf(format, ...)
+#define CALLSET_ENTRY(module, set, ...) void module ## _ ## set (void)
+#define task_create_anon(fn) fn ()
+#define task_sleep_sec(n)
+#define task_exit()
+
+/* Keep the names from clashing with the C library's */
+#define malloc slab_malloc
+#define free slab_free
+#define prealloc slab_prealloc
+
+#include "include/m6809/malloc.h"
+#include "cpu/m6809/malloc.c"
+
+#undef malloc
+#undef free
+
+
+/** The size of each block in the simulated task table */
+#define BLOCK_SIZE \
+	((offsetof (malloc_chunk_t, data) + CHUNK_DATA_SIZE + 7) & ~7)
+
+static U8 block_table[NUM_TASKS * BLOCK_SIZE] __attribute__((aligned (8)));
+
+/** The number of blocks held by tasks, and not available to malloc */
+static int task_blocks = 16;
+
+static int blocks_used;
+static int blocks_peak;
+
+static jmp_buf fatal_jmp;
+
+
+task_t *block_allocate (void)
+{
+	int n;
+
+	for (n = task_blocks; n < NUM_TASKS; n++)
+	{
+		task_t *tp = (task_t *)&block_table[n * BLOCK_SIZE];
+		if (tp->state == BLOCK_FREE)
+		{
+			tp->state = BLOCK_USED;
+			if (++blocks_used > blocks_peak)
+				blocks_peak = blocks_used;
+			return tp;
+		}
+	}
+	return NULL;
+}
+
+
+void block_free (task_t *tp)
+{
+	tp->state = BLOCK_FREE;
+	blocks_used--;
+}
+
+
+static void fatal (int err)
+{
+	longjmp (fatal_jmp, err);
+}
+
+
+/** Choose a request size.  Small requests are the most common. */
+static U8 bench_size (U8 max_size)
+{
+	U8 size = 1 + random () % max_size;
+	if (random () % 2)
+		size = 1 + size / 4;
+	return size;
+}
+
+
+static void usage (void)
+{
+	fprintf (stderr, "usage: mallocbench [-n ops] [-l live] [-m max-size]"
+		" [-t task-blocks] [-c collect-interval] [-s seed]\n");
+	exit (1);
+}
+
+
+int main (int argc, char *argv[])
+{
+	unsigned long ops = 1000000, op;
+	int live_max = 24;
+	int max_size = 48;
+	int collect_interval = 10000;
+	unsigned int seed = 1;
+	int opt;
+	U8 **live;
+	U8 *sizes;
+	int live_count = 0;
+	unsigned long requested = 0, requested_peak = 0, hard_fails = 0;
+	unsigned long byte_ops = 0;
+	clock_t start, elapsed;
+	enum chunk_type type;
+
+	while ((opt = getopt (argc, argv, "n:l:m:t:c:s:")) != -1)
+	{
+		switch (opt)
+		{
+			case 'n': ops = strtoul (optarg, NULL, 0); break;
+			case 'l': live_max = atoi (optarg); break;
+			case 'm': max_size = atoi (optarg); break;
+			case 't': task_blocks = atoi (optarg); break;
+			case 'c': collect_interval = atoi (optarg); break;
+			case 's': seed = strtoul (optarg, NULL, 0); break;
+			default: usage ();
+		}
+	}
+	if (live_max < 1 || max_size < 1 || max_size > 48
+		|| task_blocks < 0 || task_blocks >= NUM_TASKS)
+		usage ();
+
+	live = calloc (live_max, sizeof (U8 *));
+	sizes = calloc (live_max, sizeof (U8));
+	srandom (seed);
+	malloc_init ();
+
+	start = clock ();
+	for (op = 0; op < ops; op++)
+	{
+		int n = random () % live_max;
+
+		if (live[n])
+		{
+			slab_free (live[n]);
+			live[n] = NULL;
+			requested -= sizes[n];
+			live_count--;
+		}
+		else if (setjmp (fatal_jmp) == 0)
+		{
+			sizes[n] = bench_size (max_size);
+			live[n] = slab_malloc (sizes[n]);
+			memset (live[n], n, sizes[n]);
+			requested += sizes[n];
+			byte_ops += sizes[n];
+			if (requested > requested_peak)
+				requested_peak = requested;
+			live_count++;
+		}
+		else
+		{
+			live[n] = NULL;
+			hard_fails++;
+		}
+
+		if (collect_interval && (op % collect_interval) == 0)
+			malloc_collect_task ();
+	}
+	elapsed = clock () - start;
+
+	printf ("%lu ops, %d live max, sizes 1-%d, %d task blocks, seed %u\n",
+		ops, live_max, max_size, task_blocks, seed);
+	printf ("%d bytes/chunk\n\n", CHUNK_DATA_SIZE);
+	printf ("SIZE/N   ALLOCS  FAILS  IN USE  PEAK  CHUNKS\n");
+	for (type = 0; type < NUM_CHUNK_TYPES; type++)
+	{
+		struct malloc_class_stats *stats = &malloc_stats[type];
+		printf ("%4d/%d  %7u  %5u  %6u  %4u  %6u\n",
+			chunk_sizes[type], chunk_counts[type], stats->allocs, stats->fails,
+			stats->in_use, stats->peak, stats->chunks);
+	}
+	printf ("\nblocks: %d in use, %d peak, %d available\n",
+		blocks_used, blocks_peak, NUM_TASKS - task_blocks);
+	printf ("peak bytes requested: %lu of %lu in peak blocks (%lu%%)\n",
+		requested_peak, (unsigned long)blocks_peak * CHUNK_DATA_SIZE,
+		blocks_peak ? requested_peak * 100 / (blocks_peak * CHUNK_DATA_SIZE) : 0);
+	printf ("out of memory: %lu\n", hard_fails);
+	printf ("time: %.1f ns/op, %lu bytes allocated\n",
+		(double)elapsed * 1e9 / CLOCKS_PER_SEC / ops, byte_ops);
+	return 0;
+}
@@ -0,0 +1,258 @@
+/*
+ * Copyright 2011 by Brian Dominy <brian@oddchange.com>
+ *
+ * This file is part of FreeWPC.
+ *
+ * FreeWPC is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * FreeWPC is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with FreeWPC; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/* This program runs the sprintf() from kernel/printf.c on the build
+machine, over the formats used in common/, and reports how long each
+takes to print when it must be compiled first, when its compiled form
+is still cached from the previous call, and, for the formats that have
+one, from a constant plan.  It also checks that all three give the same
+text, and that it matches what the format should produce.
+
+The times are for the build machine, not the 6809, but they show how
+much of each call goes into parsing the format.
+
+	printfbench [-n iterations]
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <time.h>
+
+typedef uint8_t U8;
+typedef int8_t S8;
+typedef uint16_t U16;
+typedef int16_t S16;
+typedef uint32_t U32;
+typedef int bool;
+typedef U8 bcd_t;
+#define TRUE 1
+#define FALSE 0
+
+#define CONFIG_LITTLE_ENDIAN
+#define MACHINE_SCORE_DIGITS 10
+
+/* Arguments narrower than an int are passed as an int */
+#undef va_arg
+#define va_promote(type) \
+	__typeof__ (_Generic ((type)0, U8: 0, S8: 0, U16: 0, S16: 0, char: 0, \
+		default: (type)0))
+#define va_arg(va, type) ((type) __builtin_va_arg (va, va_promote (type)))
+
+/* The rest of the system is not here */
+#define DIV10(x,q,r) ({ q = x / 10; r = x % 10; })
+#define CALLSET_ENTRY(module, set, ...) void module ## _ ## set (void)
+#define pinio_get_bank(bankno) 0
+#define PINIO_BANK_ROM 0
+#define page_push(page)
+#define page_pop()
+struct { U8 euro_digit_sep; } system_config;
+
+/* Keep the name from clashing with the C library's */
+#define sprintf bench_sprintf
+
+#include "include/printf.h"
+#include "kernel/printf.c"
+
+
+static bcd_t score8[] = { 0x00, 0x12, 0x34, 0x50 };
+static bcd_t score10[] = { 0x01, 0x23, 0x45, 0x67, 0x80 };
+
+static const struct sprintf_op score_plan[] = {
+	SPF_FIELD (SPF_BCD, 10),
+	SPF_FINISH
+};
+
+static const struct sprintf_op ball_plan[] = {
+	SPF_TEXT ("BALL "),
+	SPF_FIELD (SPF_DECIMAL, 1),
+	SPF_FINISH
+};
+
+static const struct sprintf_op timed_plan[] = {
+	SPF_TEXT ("TIME REMAINING: "),
+	SPF_FIELD (SPF_DECIMAL, 0),
+	SPF_TEXT (":"),
+	SPF_FIELD (SPF_DECIMAL | SPF_ZEROES, 2),
+	SPF_FINISH
+};
+
+static const struct sprintf_op player_plan[] = {
+	SPF_TEXT ("PLAYER "),
+	SPF_FIELD (SPF_DECIMAL, 0),
+	SPF_FINISH
+};
+
+/* Each format is printed by a function of its own, since the arguments
+differ.  'plan' is the same format written as a constant plan, if any. */
+#define BENCH(name, args...) \
+	static void name (const char *format) { sprintf (format, ## args); }
+#define BENCH_PLAN(name, plan, args...) \
+	static void name (const char *format) { sprintf_plan (plan, ## args); }
+
+BENCH (b_score8, score8)
+BENCH (b_score10, score10)
+BENCH_PLAN (p_score10, score_plan, score10)
+BENCH (b_player, 2)
+BENCH_PLAN (p_player, player_plan, 2)
+BENCH (b_ball, 3)
+BENCH_PLAN (p_ball, ball_plan, 3)
+BENCH (b_timed, 1, 5)
+BENCH_PLAN (p_timed, timed_plan, 1, 5)
+BENCH (b_credits, 12)
+BENCH (b_fraction, 3, 1, 2)
+BENCH (b_hex, 0x12, 0xAB, 0x00, 0x7F)
+BENCH (b_star, 5, "AB")
+BENCH (b_width, "GRAND CHAMPION")
+BENCH (b_initials, 1, 'A', 'B', 'C')
+BENCH (b_date, "JAN", 5, 2011)
+BENCH (b_columns, "ABC", "DEFGHI", "JKLMN")
+BENCH (b_version, "0", "62")
+BENCH (b_text)
+
+struct bench
+{
+	const char *format;
+	void (*print) (const char *format);
+	void (*plan) (const char *format);
+	const char *expected;
+};
+
+static struct bench bench_table[] = {
+	{ "%8b", b_score8, NULL, "123,450" },
+	{ "%10b", b_score10, p_score10, "123,456,780" },
+	{ "PLAYER %d", b_player, p_player, "PLAYER 2" },
+	{ "BALL %1i", b_ball, p_ball, "BALL 3" },
+	{ "TIME REMAINING: %d:%02d", b_timed, p_timed, "TIME REMAINING: 1:05" },
+	{ "%d CREDITS", b_credits, NULL, "12 CREDITS" },
+	{ "%d %d/%d CREDITS", b_fraction, NULL, "3 1/2 CREDITS" },
+	{ "%02X %02X %02X %02X", b_hex, NULL, "12 AB 00 7F" },
+	{ "%*s", b_star, NULL, "AB" },
+	{ "%12s", b_width, NULL, "GRAND CHAMPI" },
+	{ "%d. %c%c%c", b_initials, NULL, "1. ABC" },
+	{ "%s %d, %ld", b_date, NULL, "JAN 5, 2011" },
+	{ "%3s %6s %5s", b_columns, NULL, "ABC DEFGHI JKLMN" },
+	{ "R%s.%s", b_version, NULL, "R0.62" },
+	{ "FREE PLAY", b_text, NULL, "FREE PLAY" },
+};
+
+#define NUM_BENCH (sizeof (bench_table) / sizeof (bench_table[0]))
+
+
+static double now (void)
+{
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+/** Return the average time of one call in nanoseconds.  If 'uncached',
+the cached format is forgotten before each call, so it is compiled
+every time. */
+static double bench_run (const struct bench *b,
+	void (*print) (const char *format), int iterations, bool uncached)
+{
+	double start;
+	int n;
+
+	start = now ();
+	for (n = 0; n < iterations; n++)
+	{
+		if (uncached)
+			sprintf_cache_format = NULL;
+		print (b->format);
+	}
+	return (now () - start) / iterations;
+}
+
+
+/** Print once in the given way and compare the text with what the
+format should give. */
+static bool bench_check (const struct bench *b,
+	void (*print) (const char *format), const char *how)
+{
+	sprintf_cache_format = NULL;
+	print (b->format);
+	if (strcmp (sprintf_buffer, b->expected))
+	{
+		fprintf (stderr, "printfbench: \"%s\" %s gave \"%s\", not \"%s\"\n",
+			b->format, how, sprintf_buffer, b->expected);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+
+int main (int argc, char *argv[])
+{
+	int iterations = 200000;
+	int argn;
+	unsigned int i;
+	bool ok = TRUE;
+	double compiled, cached, planned;
+	double total_compiled = 0, total_cached = 0;
+
+	for (argn = 1; argn < argc; argn++)
+	{
+		if (!strcmp (argv[argn], "-n") && argn+1 < argc)
+			iterations = strtoul (argv[++argn], NULL, 0);
+		else
+		{
+			fprintf (stderr, "usage: printfbench [-n iterations]\n");
+			exit (1);
+		}
+	}
+
+	separator_char = ',';
+
+	fprintf (stdout, "%-26s %10s %10s %10s\n", "format", "compiled", "cached", "plan");
+	for (i = 0; i < NUM_BENCH; i++)
+	{
+		const struct bench *b = &bench_table[i];
+
+		/* Run it twice, so that the second run is from the cache */
+		ok &= bench_check (b, b->print, "compiled");
+		b->print (b->format);
+		ok &= !strcmp (sprintf_buffer, b->expected) || bench_check (b, b->print, "cached");
+		if (b->plan)
+			ok &= bench_check (b, b->plan, "plan");
+
+		compiled = bench_run (b, b->print, iterations, TRUE);
+		cached = bench_run (b, b->print, iterations, FALSE);
+		total_compiled += compiled;
+		total_cached += cached;
+
+		fprintf (stdout, "%-26s %8.1fns %8.1fns", b->format, compiled, cached);
+		if (b->plan)
+		{
+			planned = bench_run (b, b->plan, iterations, FALSE);
+			fprintf (stdout, " %8.1fns", planned);
+		}
+		fprintf (stdout, "\n");
+	}
+
+	fprintf (stdout, "total: compiled %.1fns, cached %.1fns (%.0f%% saved)\n",
+		total_compiled, total_cached,
+		100.0 * (total_compiled - total_cached) / total_compiled);
+	return ok ? 0 : 1;
+}
@@ -39,6 +39,19 @@
  *                 This could be used if multiple schedules need to be
  *                 compiled into a single program.
  *
+ * -c <costfile>   Replace the estimated lengths with costs measured at
+ *                 runtime, and report the per-tick load before and after
+ *                 rebalancing.  See parse_costs for the format.
+ *
+ * -S <scale>      Multiply all measured costs by <scale>.  This allows
+ *                 costs measured on a faster host to be converted to
+ *                 the target CPU.  (1.0)
+ *
+ * -r              Generate a table of task rates for the native
+ *                 dispatcher, instead of unrolled interrupt handlers.
+ *
+ * -T <usecs>      The length of one interrupt, in microseconds.  (976)
+ *
  * Each input file is a list of items to be scheduled, generally as follows:
  * <name> <period> <length>
  *
@@ -50,11 +63,22 @@
  * This is system-dependent; on WPC, 1 interrupt = 976 microseconds.
  * period must be a power of 2.  length can be any value, including a
  * fractional one.  length can also be given in CPU cycles, by appending
- * a 'c' suffix to the value.
+ * a 'c' suffix to the value, or in microseconds with a 'u' suffix.
+ *
+ * In rate mode (-r), the period can be any value, including one shorter
+ * than an interrupt, and two more optional fields are accepted after the
+ * length: 'phase=<time>' delays the first call, and 'deadline=<time>'
+ * says when each call must have finished, relative to its release.  The
+ * deadline defaults to the period.  Both are ignored otherwise.
  *
  * The scheduler performs a 'load balancing' function based on the duration
  * of each task.  It tries to place tasks into equal-sized buckets, so that
  * on each interrupt, roughly the same amount of CPU is used.
+ *
+ * When CONFIG_RTT_PROFILE is defined (-D), every call in the generated
+ * code is bracketed by rtt_profile_begin/rtt_profile_end, and a table of
+ * task names is emitted, so that the native build can measure what each
+ * task really costs.  The cost file it writes can be given back with -c.
  */
 
 #include <stdio.h>
@@ -77,6 +101,8 @@ changed to support non-FreeWPC compilations. */
 
 #define CYCLES_PER_TICK 1952
 
+#define USECS_PER_TICK 976
+
 #define CYCLES_PER_CALL 7
 
 #define CYCLES_PER_RETURN 5
@@ -101,6 +127,12 @@ struct task
 	this task to complete during each iteration */
 	double len;
 
+	/* The measured average and worst-case lengths, in ticks, if
+	the task was listed in a cost file; otherwise both are
+	the same as 'len' */
+	double avg_len;
+	double max_len;
+
 #ifdef FUTURE
 	/* Nonzero if the function uses the "next" macro to finish
 	rather than just returning.  This allows the function to
@@ -113,6 +145,12 @@ struct task
 
 	/* The number of slots in which this task is scheduled */
 	int n_slots;
+
+	/* In rate mode, the exact period, the offset of the first call and
+	the deadline of each call, in ticks */
+	double rate_period;
+	double phase;
+	double deadline;
 };
 
 
@@ -174,6 +212,44 @@ const unsigned int cycles_per_interrupt = CYCLES_PER_TICK;
 int n_conditionals = 0;
 const char *conditionals[MAX_CONDITIONALS];
 
+/* A schedule entry, as read from an input file or the command-line.
+The entries are kept so that the schedule can be built more than
+once. */
+struct entry
+{
+	char name[MAX_ID];
+	double period;
+	double len;
+	double phase;
+	double deadline;
+};
+
+unsigned int n_entries = 0;
+struct entry entries[MAX_TASKS];
+
+/* A measured task cost, as read from a cost file. */
+struct cost
+{
+	char name[MAX_ID];
+	double avg_len;
+	double max_len;
+};
+
+unsigned int n_costs = 0;
+struct cost costs[MAX_TASKS];
+
+/* Nonzero when measured costs should be used for balancing */
+int use_costs = 0;
+
+/* The factor applied to all measured costs */
+double cost_scale = 1.0;
+
+/* Nonzero to generate a rate table instead of interrupt handlers */
+int rate_mode = 0;
+
+/* The length of one interrupt, in microseconds */
+double usecs_per_tick = USECS_PER_TICK;
+
 
 #define cfprintf(ind, file, format, rest...) \
 do { \
@@ -206,6 +282,37 @@ static void write_time_comment (FILE *f, double time)
 }
 
 
+/**
+ * Return nonzero if a conditional was defined with -D.
+ */
+int conditional_defined_p (const char *name)
+{
+	int cond;
+	for (cond = 0; cond < n_conditionals; cond++)
+		if (!strcmp (conditionals[cond], name))
+			return 1;
+	return 0;
+}
+
+
+/**
+ * When profiling, write the table of task names, indexed by the number
+ * passed to rtt_profile_end.
+ */
+void write_profile_names (FILE *f)
+{
+	unsigned int n;
+
+	fprintf (f, "extern void rtt_profile_begin (void);\n");
+	fprintf (f, "extern void rtt_profile_end (unsigned int id);\n\n");
+	fprintf (f, "const unsigned int %s_profile_count = %d;\n", prefix, n_tasks);
+	fprintf (f, "const char *%s_profile_names[] = {\n", prefix);
+	for (n=0; n < n_tasks; n++)
+		fprintf (f, "   \"%s\",\n", tasks[n].name + (tasks[n].name[0] == '!'));
+	fprintf (f, "};\n\n");
+}
+
+
 /**
  * Write the driver code to the output file.
  */
@@ -216,6 +323,7 @@ void write_tick_driver (FILE *f)
 	char task_name[MAX_ID];
 	unsigned int indent = 0;
 	double tick_len;
+	int profile_p = conditional_defined_p ("CONFIG_RTT_PROFILE");
 
 	/* Write preliminary definitions */
 
@@ -228,6 +336,9 @@ void write_tick_driver (FILE *f)
 		fprintf (f, "#include \"%s\"\n", include_files[n].name);
 	fprintf (f, "\n");
 
+	if (profile_p)
+		write_profile_names (f);
+
 	/* Check for tasks that could be improved */
 
 	for (n=0; n < n_tasks; n++)
@@ -318,9 +429,14 @@ void write_tick_driver (FILE *f)
 					if (!inline_p)
 						cfprintf (indent, f, "extern void %s (void);\n", task_name);
 
+					if (profile_p)
+						cfprintf (indent, f, "rtt_profile_begin ();\n");
 					cfprintf (indent, f, "%s (); ", task_name);
 					write_time_comment (f, slot->task->len);
 					fprintf (f, "\n");
+					if (profile_p)
+						cfprintf (indent, f, "rtt_profile_end (%d);\n",
+							(int)(slot->task - tasks));
 				}
 			}
 		}
@@ -373,6 +489,117 @@ void write_tick_driver (FILE *f)
 }
 
 
+static unsigned long ticks_to_usecs (double time)
+{
+	return (unsigned long)(time * usecs_per_tick + 0.5);
+}
+
+
+/**
+ * Write a table of task rates to the output file.  Instead of being
+ * called from unrolled interrupt handlers, each task is released by the
+ * native dispatcher at its own period, in microseconds.
+ *
+ * Tasks are referenced by function pointer, so inline and already
+ * unrolled tasks get a wrapper function, and so does every task when
+ * profiling, to bracket the call.  Only the system schedule is profiled;
+ * the native dispatcher's own table is not part of it.
+ */
+void write_rate_table (FILE *f)
+{
+	unsigned int n, i;
+	unsigned int indent = 0;
+	double load = 0.0;
+	int profile_p = conditional_defined_p ("CONFIG_RTT_PROFILE")
+		&& !strcmp (prefix, "tick");
+
+	write_comment (indent, f, "Automatically generated by gensched");
+	for (n=0; n < n_includes; n++)
+		fprintf (f, "#include \"%s\"\n", include_files[n].name);
+	fprintf (f, "\n");
+
+	if (profile_p)
+		write_profile_names (f);
+
+	for (n=0; n < n_tasks; n++)
+	{
+		struct task *task = &tasks[n];
+		int inline_p = task->name[0] == '!';
+		const char *name = task->name + inline_p;
+
+		load += task->len / task->rate_period;
+		if (task->deadline < task->len)
+			fprintf (stderr, "warning: %s cannot meet its deadline\n", name);
+
+		if (!task->already_unrolled_count && !inline_p)
+			fprintf (f, "extern void %s (void);\n", name);
+		if (!task->already_unrolled_count && !inline_p && !profile_p)
+			continue;
+
+		fprintf (f, "static void %s_rtt_%d (void)\n", prefix, n);
+		c_block_begin (indent, f);
+		if (task->already_unrolled_count)
+		{
+			/* An unrolled task calls its parts in turn */
+			cfprintf (indent, f, "static unsigned char part;\n");
+			for (i = 0; i < task->already_unrolled_count; i++)
+				cfprintf (indent, f, "extern void %s_%d (void);\n", name, i);
+			if (profile_p)
+				cfprintf (indent, f, "rtt_profile_begin ();\n");
+			cfprintf (indent, f, "switch (part)\n");
+			c_block_begin (indent, f);
+			for (i = 0; i < task->already_unrolled_count; i++)
+				cfprintf (indent, f, "case %d: %s_%d (); break;\n", i, name, i);
+			c_block_end (indent, f);
+			if (profile_p)
+				cfprintf (indent, f, "rtt_profile_end (%d);\n", n);
+			cfprintf (indent, f, "if (++part == %d)\n", task->already_unrolled_count);
+			cfprintf (indent, f, "\tpart = 0;\n");
+		}
+		else
+		{
+			if (profile_p)
+				cfprintf (indent, f, "rtt_profile_begin ();\n");
+			cfprintf (indent, f, "%s ();\n", name);
+			if (profile_p)
+				cfprintf (indent, f, "rtt_profile_end (%d);\n", n);
+		}
+		c_block_end (indent, f);
+	}
+	fprintf (f, "\n");
+
+	fprintf (f, "struct rtt_rate %s_rates[] = {\n", prefix);
+	for (n=0; n < n_tasks; n++)
+	{
+		struct task *task = &tasks[n];
+		const char *name = task->name + (task->name[0] == '!');
+
+		cfprintf (1, f, "{ ");
+		if (task->already_unrolled_count || task->name[0] == '!' || profile_p)
+			fprintf (f, "%s_rtt_%d", prefix, n);
+		else
+			fprintf (f, "%s", name);
+		fprintf (f, ", %lu, %lu, %lu, \"%s\" }, ",
+			ticks_to_usecs (task->rate_period), ticks_to_usecs (task->phase),
+			ticks_to_usecs (task->deadline), name);
+		write_time_comment (f, task->len);
+		fprintf (f, "\n");
+	}
+	fprintf (f, "};\n\n");
+
+	fprintf (f, "struct rtt_rate_table %s_table = { %s_rates, %d };\n\n",
+		prefix, prefix, n_tasks);
+
+	cfprintf (indent, f, "void %s_init (void)\n{\n", prefix);
+	cfprintf (indent, f, "   rtt_rate_init (&%s_table);\n", prefix);
+	cfprintf (indent, f, "}\n\n");
+
+	if (load >= 1.0)
+		fprintf (stderr, "warning: schedule needs %d%% of the CPU\n",
+			(int)(load * 100));
+}
+
+
 /**
  * Expand the tick table to a width of 'new_tick_count'.
  */
@@ -403,6 +630,7 @@ void init_schedule (void)
 {
 	n_ticks = 0;
 	n_tasks = 0;
+	max_divider = 1;
 	expand_ticks (8);
 }
 
@@ -487,14 +715,12 @@ struct slot *alloc_slot (unsigned int tickno)
 
 
 /**
- * Add a new task to the schedule.
+ * Declare a new task, with NAME as given in a schedule file.
+ * Returns NULL if the task depends on a conditional that is not defined.
  */
-void add_task (char *name, unsigned int period, double len)
+struct task *new_task (char *name, double len)
 {
-	unsigned int count, base;
-	struct slot *slot;
 	struct task *task;
-	unsigned int divider = 1;
 	char *end;
 	unsigned int already_unrolled_count = 0;
 	char *c;
@@ -503,21 +729,12 @@ void add_task (char *name, unsigned int period, double len)
 	/* Is this entry dependent on a conditional? */
 	if ((c = strchr (name, '?')) != NULL)
 	{
-		int cond;
-		for (cond = 0; cond < n_conditionals; cond++)
-		{
-			if (!strcmp (conditionals[cond], c+1))
-			{
-				/* The conditional exists.  Proceed, and strip off
-				the conditional part of the expression. */
-				*c = '\0';
-				goto conditional_defined;
-			}
-		}
-		/* The conditional is not defined.  Do not define this task. */
-		return;
+		/* If the conditional is not defined, do not define this task.
+		Otherwise, strip off the conditional part of the expression. */
+		if (!conditional_defined_p (c+1))
+			return NULL;
+		*c = '\0';
 	}
-conditional_defined:;
 
 	/* Support names of the form <function>/<divider>.
 	This means that the function has already been unrolled. */
@@ -542,11 +759,39 @@ conditional_defined:;
 	/* Fill in the task structure */
 	task = &tasks[n_tasks++];
 	strcpy (task->name, name);
-	task->period = period;
-	task->len = len;
+	task->avg_len = task->max_len = len;
 	task->already_unrolled_count = already_unrolled_count;
 	task->n_slots = 0;
 
+	/* If a cost was measured for this task, use it */
+	for (n = 0; n < n_costs; n++)
+		if (!strcmp (costs[n].name, name + (name[0] == '!')))
+		{
+			task->avg_len = costs[n].avg_len;
+			task->max_len = costs[n].max_len;
+			break;
+		}
+	task->len = use_costs ? task->avg_len : len;
+	return task;
+}
+
+
+/**
+ * Add a new task to the schedule.
+ */
+void add_task (char *name, unsigned int period, double len)
+{
+	unsigned int count, base;
+	struct slot *slot;
+	struct task *task;
+	unsigned int divider = 1;
+
+	task = new_task (name, len);
+	if (!task)
+		return;
+	task->period = period;
+	len = task->len;
+
 	/* Figure out how many slots this task should be assigned to.
 	 *
 	 * If the periodicity is greater than the number of times
@@ -638,6 +883,10 @@ double parse_time (const char *string)
 		case 'C':
 			return strtod (string, NULL) / (1.0 * cycles_per_interrupt);
 
+		case 'u':
+		case 'U':
+			return strtod (string, NULL) / usecs_per_tick;
+
 		default:	
 			return strtod (string, NULL);
 	}
@@ -650,20 +899,32 @@ double parse_time (const char *string)
 void parse_sched_entry (char *line)
 {
 	char *name;
-	unsigned int period;
-	float len;
+	double period;
+	double len;
+	double phase = 0.0;
+	double deadline = 0.0;
+	char *field;
 	const char *delims = " \t\n";
 
 	name = strtok (line, delims);
 	if (!name || *name == '#')
 		return;
 
-	period = (unsigned int)parse_time (strtok (NULL, delims));
-	if (period & (period - 1))
+	period = parse_time (strtok (NULL, delims));
+	if (!rate_mode)
 	{
-		fprintf (stderr,
-			"error: invalid period '%d' for '%s' (must be power of 2)\n",
-			period, name);
+		unsigned int ticks = (unsigned int)period;
+		if (ticks != period || ticks == 0 || (ticks & (ticks - 1)))
+		{
+			fprintf (stderr,
+				"error: invalid period '%g' for '%s' (must be power of 2)\n",
+				period, name);
+			exit (1);
+		}
+	}
+	else if (period <= 0.0)
+	{
+		fprintf (stderr, "error: invalid period for '%s'\n", name);
 		exit (1);
 	}
 
@@ -675,7 +936,141 @@ void parse_sched_entry (char *line)
 		exit (1);
 	}
 
-	add_task (name, period, len);
+	/* Parse the optional fields */
+	while ((field = strtok (NULL, delims)) != NULL && *field != '#')
+	{
+		if (!strncmp (field, "phase=", 6))
+			phase = parse_time (field + 6);
+		else if (!strncmp (field, "deadline=", 9))
+			deadline = parse_time (field + 9);
+		else
+		{
+			fprintf (stderr, "error: unknown field '%s' for '%s'\n", field, name);
+			exit (1);
+		}
+	}
+
+	if (n_entries == MAX_TASKS)
+	{
+		fprintf (stderr, "error: too many tasks\n");
+		exit (1);
+	}
+	strcpy (entries[n_entries].name, name);
+	entries[n_entries].period = period;
+	entries[n_entries].len = len;
+	entries[n_entries].phase = phase;
+	entries[n_entries].deadline = deadline > 0.0 ? deadline : period;
+	n_entries++;
+}
+
+
+/**
+ * Build the schedule from all of the entries read so far.
+ */
+void build_schedule (void)
+{
+	unsigned int n;
+	char name[MAX_ID];
+
+	init_schedule ();
+	for (n = 0; n < n_entries; n++)
+	{
+		strcpy (name, entries[n].name);
+		if (rate_mode)
+		{
+			struct task *task = new_task (name, entries[n].len);
+			if (!task)
+				continue;
+			task->rate_period = entries[n].period;
+			task->phase = entries[n].phase;
+			task->deadline = entries[n].deadline;
+			task->period = 1;
+		}
+		else
+			add_task (name, (unsigned int)entries[n].period, entries[n].len);
+	}
+}
+
+
+/**
+ * Parse a cost file.  Each line gives the name of a task, as written
+ * by the profiler (without any '!', conditional, or unroll suffix),
+ * followed by its average and worst-case lengths.  The lengths take
+ * the same suffixes as in a schedule file; the profiler writes them
+ * in microseconds.  Anything after that on the line is ignored.
+ */
+void parse_costs (FILE *f)
+{
+	char line[512];
+	const char *delims = " \t\n";
+	char *name, *avg, *max;
+
+	while (fgets (line, 511, f))
+	{
+		name = strtok (line, delims);
+		if (!name || *name == '#')
+			continue;
+		avg = strtok (NULL, delims);
+		max = strtok (NULL, delims);
+		if (!avg)
+			continue;
+
+		if (n_costs == MAX_TASKS)
+		{
+			fprintf (stderr, "error: too many costs\n");
+			exit (1);
+		}
+		strcpy (costs[n_costs].name, name);
+		costs[n_costs].avg_len = parse_time (avg) * cost_scale;
+		costs[n_costs].max_len = (max ? parse_time (max) : parse_time (avg))
+			* cost_scale;
+		n_costs++;
+	}
+}
+
+
+/**
+ * Report the load on each tick of the current schedule, using the
+ * measured costs wherever they are known.  The average load counts
+ * each divided task by how often it actually runs; the worst case
+ * assumes every task in the tick runs, for its longest measured time.
+ */
+void report_load (const char *what)
+{
+	unsigned int n, slotno;
+	double avg_total = 0.0, avg_busiest = 0.0, worst = 0.0;
+	unsigned int busiest = 0, worst_tick = 0;
+
+	for (n = 0; n < n_ticks; n++)
+	{
+		struct tick *tick = &ticks[n];
+		double avg_len = 0.0, max_len = 0.0;
+
+		for (slotno = 0; slotno < tick->n_slots; slotno++)
+		{
+			struct slot *slot = &tick->slots[slotno];
+			avg_len += slot->task->avg_len / slot->divider;
+			max_len += slot->task->max_len;
+		}
+
+		avg_total += avg_len;
+		if (avg_len > avg_busiest)
+		{
+			avg_busiest = avg_len;
+			busiest = n;
+		}
+		if (max_len > worst)
+		{
+			worst = max_len;
+			worst_tick = n;
+		}
+	}
+
+	fprintf (stderr, "%s: average %dc, busiest tick %d at %dc, worst case tick %d at %dc\n",
+		what,
+		(int)(avg_total / n_ticks * cycles_per_interrupt),
+		busiest, (int)(avg_busiest * cycles_per_interrupt),
+		worst_tick, (int)(worst * cycles_per_interrupt));
 }
 
 
@@ -710,8 +1105,7 @@ int main (int argc, char *argv[])
 {
 	unsigned int argn;
 	FILE *outfile = stdout;
-
-	init_schedule ();
+	const char *costfile = NULL;
 
 	argn = 1;
 	while (argn < argc)
@@ -746,8 +1140,30 @@ int main (int argc, char *argv[])
 					break;
 
 				case 'D':
+					if (n_conditionals == MAX_CONDITIONALS)
+					{
+						fprintf (stderr, "error: too many conditionals\n");
+						exit (1);
+					}
 					conditionals[n_conditionals++] = argv[argn];
 					break;
+
+				case 'c':
+					costfile = argv[argn];
+					break;
+
+				case 'S':
+					cost_scale = strtod (argv[argn], NULL);
+					break;
+
+				case 'r':
+					rate_mode = 1;
+					argn--;
+					break;
+
+				case 'T':
+					usecs_per_tick = strtod (argv[argn], NULL);
+					break;
 			}
 		}
 		else
@@ -764,7 +1180,35 @@ int main (int argc, char *argv[])
 		argn++;
 	}
 
-	write_tick_driver (outfile);
+	/* With measured costs, first build the schedule from the estimates
+	so that the load can be compared, then rebalance. */
+	if (costfile)
+	{
+		FILE *infile = fopen (costfile, "r");
+		if (!infile)
+		{
+			fprintf (stderr, "error: cannot open costs '%s'\n", costfile);
+			exit (1);
+		}
+		parse_costs (infile);
+		fclose (infile);
+
+		if (!rate_mode)
+		{
+			build_schedule ();
+			report_load ("estimated");
+		}
+		use_costs = 1;
+	}
+
+	build_schedule ();
+	if (costfile && !rate_mode)
+		report_load ("measured");
+
+	if (rate_mode)
+		write_rate_table (outfile);
+	else
+		write_tick_driver (outfile);
 	if (outfile != stdout)
 		fclose (outfile);
 	return 0;